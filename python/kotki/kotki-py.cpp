@@ -15,11 +15,26 @@ string translate(const string& input, const string& language) {
   return kotki_->translate(input, language);
 }
 
+vector<string> translateMany(const vector<string>& inputs, const string& language) {
+  if(kotki_ == nullptr) _init();
+  return kotki_->translateMany(inputs, language);
+}
+
+map<string, string> translateToMany(const string& input, const string& from, const vector<string>& to) {
+  if(kotki_ == nullptr) _init();
+  return kotki_->translateToMany(input, from, to);
+}
+
 map<string, map<string, string>> listModels() {
   if(kotki_ == nullptr) _init();
   return kotki_->listModels();
 }
 
+map<string, map<string, double>> preload(const vector<string>& models) {
+  if(kotki_ == nullptr) _init();
+  return kotki_->preload(models);
+}
+
 void _init() {
   kotki_ = new Kotki();
 }
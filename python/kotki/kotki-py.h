@@ -21,7 +21,10 @@ static Kotki *kotki_ = nullptr;
 int scan();
 int scan(const string& pathToJsonConfig);
 string translate(const string& input, const string& language);
+vector<string> translateMany(const vector<string>& inputs, const string& language);
+map<string, string> translateToMany(const string& input, const string& from, const vector<string>& to);
 map<string, map<string, string>> listModels();
+map<string, map<string, double>> preload(const vector<string>& models);
 void _init();
 
 PYBIND11_MODULE(kotki, m) {
@@ -30,5 +33,8 @@ PYBIND11_MODULE(kotki, m) {
   m.def("scan", pybind11::overload_cast<>(&scan), "Recursively search for 'registry.json' in various places. Returns amount of models loaded.");
   m.def("scan", pybind11::overload_cast<const std::string &>(&scan), "Load registry.json from a supplied path. Returns amount of models loaded.", pybind11::arg("path"));
   m.def("translate", &translate, "translate some text", pybind11::arg("text"), pybind11::arg("model"));
+  m.def("translateMany", &translateMany, "translate a list of texts in shared batches", pybind11::arg("texts"), pybind11::arg("model"));
+  m.def("translateToMany", &translateToMany, "translate some text into several languages, sharing common hops", pybind11::arg("text"), pybind11::arg("source"), pybind11::arg("targets"));
   m.def("listModels", &listModels, "list loaded translation models");
+  m.def("preload", &preload, "load and warm up models in parallel, all when empty. Returns seconds spent per model.", pybind11::arg("models") = vector<string>());
 }
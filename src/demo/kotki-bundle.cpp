@@ -0,0 +1,75 @@
+// Packs the models of a registry into single-file bundles (see kotki/model_bundle.h), next to a registry.json
+// that refers to them, so the output directory can be scanned like any other model directory.
+//    cmake -Bbuild -DBUILD_DEMO=1
+//    make -Cbuild -j6
+//    ./build/src/kotki-bundle ~/.config/kotki/models/firefox/registry.json /tmp/bundles/
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "kotki/kotki.h"
+#include "kotki/utils.h"
+
+using namespace std;
+using namespace marian::bergamot;
+
+int main(int argc, char *argv[]) {
+  if(argc != 3) {
+    cerr << "usage: " << argv[0] << " <registry.json> <output-dir>" << endl;
+    return 1;
+  }
+
+  const filesystem::path outDir = argv[2];
+  filesystem::create_directories(outDir);
+
+  Kotki kotki;
+  vector<KotkiTranslationModel*> models = kotki.loadRegistry(argv[1]);
+
+  ofstream registry(outDir / "registry.json");
+  registry << "{";
+  bool first = true;
+  for(auto *model: models) {
+    auto paths = model->toJson();
+    if(paths.count("bundle")) {
+      cerr << "Skipping model " << model->name << " because it is already a bundle" << endl;
+      continue;
+    }
+    // bundles hand the model to marian as memory, which only works for the binary format
+    if(!endsWith(paths["model"], ".bin")) {
+      cerr << "Skipping model " << model->name << " because " << paths["model"] << " is not a .bin model" << endl;
+      continue;
+    }
+
+    const bool diffVocabs = !paths.count("vocab");
+    MappedFile modelFile(paths["model"]);
+    MappedFile lexFile(paths["lex"]);
+    MappedFile vocabFile(diffVocabs ? paths["srcvocab"] : paths["vocab"]);
+    MappedFile trgVocabFile(diffVocabs ? paths["trgvocab"] : paths["vocab"]);
+    const string options = string("gemm-precision: ") +
+        (endsWith(paths["model"], "intgemm8.bin") ? "int8shiftAll" : "int8shiftAlphaAll") + "\n";
+
+    vector<pair<BundleSection, string_view>> sections = {
+        {BundleSection::model, string_view(modelFile.begin(), modelFile.size())},
+        {BundleSection::shortlist, string_view(lexFile.begin(), lexFile.size())},
+        {BundleSection::sourceVocab, string_view(vocabFile.begin(), vocabFile.size())},
+        {BundleSection::ssplitPrefixes, model->nbPrefixes()},
+        {BundleSection::options, options},
+    };
+    if(diffVocabs) {
+      sections.emplace_back(BundleSection::targetVocab, string_view(trgVocabFile.begin(), trgVocabFile.size()));
+    }
+
+    const string fileName = model->name + ".kbundle";
+    size_t size = writeModelBundle(sections, (outDir / fileName).string());
+    cout << model->name << " -> " << (outDir / fileName).string() << " (" << size << " bytes)" << endl;
+
+    registry << (first ? "" : ",") << "\n  \"" << model->name << "\": {\"bundle\": {\"name\": \"" << fileName << "\"}}";
+    first = false;
+  }
+  registry << "\n}\n";
+
+  for(auto *model: models) { delete model; }
+  return 0;
+}
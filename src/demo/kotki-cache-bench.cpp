@@ -0,0 +1,83 @@
+// Compares the translation cache variants (AtomicCache, RcuCache) under concurrent lookups.
+// Keys follow a Zipfian distribution, a miss is followed by a store, as Request does after translating.
+//    cmake -Bbuild -DBUILD_DEMO=1
+//    make -Cbuild -j6
+//    ./build/src/kotki-cache-bench
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kotki/cache.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace marian::bergamot;
+
+const size_t cacheSize = 1 << 16;
+const size_t mutexBuckets = 64;
+const size_t distinctKeys = 1 << 20;
+const size_t opsPerThread = 1 << 20;
+
+vector<size_t> zipfianKeys(size_t count, unsigned int seed) {
+  // inverse CDF over precomputed weights, s = 1.0
+  static vector<double> cdf = [] {
+    vector<double> weights(distinctKeys);
+    double sum = 0;
+    for(size_t i = 0; i < distinctKeys; i++) {
+      sum += 1.0 / static_cast<double>(i + 1);
+      weights[i] = sum;
+    }
+    for(auto &w: weights) { w /= sum; }
+    return weights;
+  }();
+
+  mt19937_64 rng(seed);
+  uniform_real_distribution<double> uniform(0.0, 1.0);
+  vector<size_t> keys(count);
+  for(auto &key: keys) {
+    key = lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+  }
+  return keys;
+}
+
+template <class Cache>
+void run(const string &name, size_t numThreads, const vector<vector<size_t>> &keys) {
+  Cache cache(cacheSize, mutexBuckets);
+  auto value = make_shared<string>("a cached translation");
+
+  vector<thread> threads;
+  auto then = steady_clock::now();
+  for(size_t t = 0; t < numThreads; t++) {
+    threads.emplace_back([&cache, &keys, &value, t]() {
+      for(const size_t key: keys[t]) {
+        if(!cache.find(key).first) {
+          cache.store(key, value);
+        }
+      }
+    });
+  }
+  for(auto &t: threads) { t.join(); }
+  auto took = duration_cast<duration<double>>(steady_clock::now() - then).count();
+
+  auto stats = cache.stats();
+  double ops = static_cast<double>(numThreads * opsPerThread);
+  cout << name << "\tthreads: " << numThreads
+       << "\tMops/s: " << ops / took / 1e6
+       << "\thit rate: " << static_cast<double>(stats.hits) / (stats.hits + stats.misses) << endl;
+}
+
+int main() {
+  vector<vector<size_t>> keys;
+  for(size_t numThreads = 1; numThreads <= 64; numThreads *= 2) {
+    while(keys.size() < numThreads) {
+      keys.emplace_back(zipfianKeys(opsPerThread, keys.size()));
+    }
+    run<AtomicCache<size_t, shared_ptr<string>>>("AtomicCache", numThreads, keys);
+    run<RcuCache<size_t, shared_ptr<string>>>("RcuCache", numThreads, keys);
+  }
+  return 0;
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdlib>
+#include <memory>
 #include <new>
 #ifdef _MSC_VER
 // Ensure _HAS_EXCEPTIONS is defined
@@ -42,7 +43,12 @@ template <class T> class AlignedVector {
 #endif
     }
 
-    AlignedVector(AlignedVector &&from) : mem_(from.mem_), size_(from.size_) {
+    // Wraps memory that is owned elsewhere, such as a memory-mapped file. owner keeps it alive and is released along
+    // with this vector. The caller is responsible for mem satisfying the required alignment.
+    AlignedVector(T *mem, std::size_t size, std::shared_ptr<void> owner)
+      : mem_(mem), size_(size), owner_(std::move(owner)) {}
+
+    AlignedVector(AlignedVector &&from) : mem_(from.mem_), size_(from.size_), owner_(std::move(from.owner_)) {
       from.mem_ = nullptr;
       from.size_ = 0;
     }
@@ -52,6 +58,7 @@ template <class T> class AlignedVector {
       release();
       mem_ = from.mem_;
       size_ = from.size_;
+      owner_ = std::move(from.owner_);
       from.mem_ = nullptr;
       from.size_ = 0;
       return *this;
@@ -78,8 +85,13 @@ template <class T> class AlignedVector {
   private:
     T *mem_;
     std::size_t size_;
+    std::shared_ptr<void> owner_;
 
     void release() {
+      if (owner_) {
+        owner_.reset();
+        return;
+      }
 #ifdef _MSC_VER
       _aligned_free(mem_);
 #else
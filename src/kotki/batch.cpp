@@ -1,19 +1,32 @@
 #include "kotki/batch.h"
 #include "kotki/request.h"
+#include "marian-lite/common/logging.h"
 
 namespace marian {
 namespace bergamot {
 
-void Batch::log() {
-  size_t numTokens{0}, maxLength{0};
+Batch::Stats Batch::stats() const {
+  Stats stats;
+  size_t maxLength{0};
   for (auto &sentence : sentences_) {
-    numTokens += sentence.numTokens();
+    stats.tokens += sentence.numTokens();
     maxLength = std::max(maxLength, static_cast<size_t>(sentence.numTokens()));
   }
+  stats.sentences = sentences_.size();
+  stats.paddedTokens = stats.sentences * maxLength;
+  return stats;
+}
+
+void Batch::log(const Stats &stats) {
+  double padding = stats.paddedTokens == 0 ? 0.0 : 100.0 * (stats.paddedTokens - stats.tokens) / stats.paddedTokens;
+  LOG(debug, "Batch of {} sentences: {} tokens, {} padded tokens ({:.1f}% padding)", stats.sentences, stats.tokens,
+      stats.paddedTokens, padding);
 }
 
 void Batch::add(const RequestSentence &sentence) { sentences_.push_back(sentence); }
 
+void Batch::add(RequestSentence &&sentence) { sentences_.push_back(std::move(sentence)); }
+
 void Batch::completeBatch(const Histories &histories) {
   for (size_t i = 0; i < sentences_.size(); i++) {
     sentences_[i].completeSentence(histories[i]);
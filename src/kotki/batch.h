@@ -16,6 +16,7 @@ class Batch {
   size_t size() const { return sentences_.size(); }
 
   void add(const RequestSentence &sentence);
+  void add(RequestSentence &&sentence);
 
   // Accessors to read from a Batch. For use in BatchTranslator (consumer on a
   // PCQueue holding batches).
@@ -30,8 +31,15 @@ class Batch {
   // the future given to client.
   void completeBatch(const Histories &histories);
 
-  // Convenience function to log batch-statistics. numTokens, max-length.
-  void log();
+  struct Stats {
+    size_t sentences{0};
+    size_t tokens{0};        ///< tokens of all sentences
+    size_t paddedTokens{0};  ///< sentences times the longest one, what translating the batch costs
+  };
+  Stats stats() const;
+
+  // Convenience function to log batch-statistics, see Stats.
+  static void log(const Stats &stats);
 
  private:
   RequestSentences sentences_;
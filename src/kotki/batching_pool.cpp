@@ -1,6 +1,8 @@
 #include "kotki/batching_pool.h"
 
+#include <algorithm>
 #include <cassert>
+#include <limits>
 
 #include "kotki/batch.h"
 #include "marian-lite/common/logging.h"
@@ -9,7 +11,9 @@ namespace marian {
 namespace bergamot {
 
 BatchingPool::BatchingPool(Ptr<Options> options)
-    : miniBatchWords_(options->get<int>("mini-batch-words")), maxActiveBucketLength_(0) {
+    : miniBatchWords_(options->get<int>("mini-batch-words")),
+      batchOverhead_(options->get<int>("mini-batch-overhead", 64)),
+      maxActiveBucketLength_(0) {
   size_t maxLengthBreak = options->get<int>("max-length-break");
   float maxLengthFactor = options->get<float>("max-length-factor", 3.0);
 
@@ -27,62 +31,181 @@ BatchingPool::BatchingPool(Ptr<Options> options)
 }
 
 size_t BatchingPool::generateBatch(Batch &batch) {
-  // For now simply iterates on buckets and converts batches greedily.  This
-  // has to be enhanced with optimizing over priority. The baseline
-  // implementation should at least be as fast as marian's maxi-batch with full
-  // corpus size as maxi-batch size.
   batch.clear();
-  size_t paddedBatchSize = 0;
 
+  // Queues are ordered by urgency (see less), so the most urgent sentence of all is at the front
+  // of one of them: of the most urgent Priority pending. It goes into this batch whatever its length, no later arrival
+  // or shorter sentence overtakes it.
+  size_t cls = numPriorities;
   for (size_t length = 0; length <= maxActiveBucketLength_; length++) {
-    auto p = bucket_[length].begin();
-    while (p != bucket_[length].end()) {
-      paddedBatchSize = (batch.size() + 1) * length;
-      if (paddedBatchSize <= miniBatchWords_) {
-        auto q = p++;
-        batch.add(*q);
-        bucket_[length].erase(q);
-      } else {
-        // Check if elements exist
-        assert(batch.size() > 0);
-        return batch.size();
+    cls = std::min(cls, frontClass(length));
+  }
+  if (cls == numPriorities) {
+    return 0;
+  }
+  size_t anchor = bucket_.size();
+  for (size_t length = 0; length <= maxActiveBucketLength_; length++) {
+    if (!bucket_[length][cls].empty() && (anchor == bucket_.size() || less(front(length, cls), front(anchor, cls)))) {
+      anchor = length;
+    }
+  }
+
+  auto [shortest, longest] = planBatch(static_cast<Priority>(cls), anchor);
+  size_t width = anchor;
+  take(anchor, cls, batch);
+
+  // Then the sentences of its class within the planned lengths, most urgent first.
+  while (true) {
+    size_t next = bucket_.size();
+    for (size_t length = shortest; length <= longest; length++) {
+      if (!bucket_[length][cls].empty() && (next == bucket_.size() || less(front(length, cls), front(next, cls)))) {
+        next = length;
       }
     }
+    if (next == bucket_.size() || (batch.size() + 1) * std::max(width, next) > miniBatchWords_) {
+      break;
+    }
+    take(next, cls, batch);
+    width = std::max(width, next);
+  }
+
+  // Less urgent sentences only take what is left at the width reached, where they cost no extra padding. Longest first,
+  // they leave the least of it unused.
+  for (size_t length = width + 1; length-- > 0;) {
+    for (size_t fill = frontClass(length); fill < numPriorities && (batch.size() + 1) * width <= miniBatchWords_;
+         fill = frontClass(length)) {
+      take(length, fill, batch);
+    }
   }
 
   return batch.size();
 }
 
+std::pair<size_t, size_t> BatchingPool::planBatch(Priority priority, size_t anchor) const {
+  const size_t cls = static_cast<size_t>(priority);
+  std::vector<size_t> lengths;
+  std::vector<size_t> total = {0};
+  for (size_t length = 0; length <= maxActiveBucketLength_; length++) {
+    if (!bucket_[length][cls].empty()) {
+      lengths.push_back(length);
+      total.push_back(total.back() + bucket_[length][cls].size());
+    }
+  }
+
+  // cost[j]: least padded tokens (and overhead) for the sentences of the first j lengths, the last batch(es) of which
+  // span lengths[from[j]] to lengths[j - 1]. Sentences of one length go into one run of batches, the longest of them
+  // pads all.
+  const size_t m = lengths.size();
+  std::vector<size_t> cost(m + 1, std::numeric_limits<size_t>::max()), from(m + 1, 0);
+  cost[0] = 0;
+  for (size_t j = 1; j <= m; j++) {
+    const size_t width = std::max<size_t>(lengths[j - 1], 1);
+    const size_t capacity = std::max<size_t>(miniBatchWords_ / width, 1);
+    for (size_t i = 0; i < j; i++) {
+      const size_t sentences = total[j] - total[i];
+      const size_t batches = (sentences + capacity - 1) / capacity;
+      const size_t candidate = cost[i] + sentences * width + batches * batchOverhead_;
+      if (candidate < cost[j]) {
+        cost[j] = candidate;
+        from[j] = i;
+      }
+    }
+  }
+
+  for (size_t j = m; j > 0; j = from[j]) {
+    if (lengths[from[j]] <= anchor) {
+      return {lengths[from[j]], lengths[j - 1]};
+    }
+  }
+  return {anchor, anchor};
+}
+
+void BatchingPool::take(size_t length, size_t cls, Batch &batch) {
+  auto less = [this](SentenceHandle a, SentenceHandle b) { return this->less(a, b); };
+  SentenceHandle handle = bucket_[length][cls].front(less);
+  bucket_[length][cls].pop(less);
+  pendingTokens_ -= length;
+
+  // The batch holds its own reference while translating. The last sentence of a request hands over the pool's.
+  RequestSlot &slot = requests_[handle.request];
+  if (--slot.pending > 0) {
+    batch.add(RequestSentence(handle.index, slot.request));
+    return;
+  }
+  requestSlots_.erase(slot.request.get());
+  batch.add(RequestSentence(handle.index, std::move(slot.request)));
+  slot.request = nullptr;
+  freeRequests_.push_back(handle.request);
+}
+
 size_t BatchingPool::enqueueRequest(Ptr<Request> request) {
   size_t toBeFreshlyTranslated = 0;
   for (size_t i = 0; i < request->numSegments(); i++) {
-    if (!request->cacheHitPrefilled(i)) {
-      RequestSentence sentence(i, request);
-      size_t bucket_id = sentence.numTokens();
-
-      // Due to a workaround for pivoting, unless we can discipline the
-      // vocabulary to get stronger static requirements, it is difficult to
-      // rework the rest of the components. Instead, we allow dynamic growth
-      // here. We let std::vector take care of the dynamic growth.
-      // https://en.cppreference.com/w/cpp/container/vector/resize#Complexity
-      if (bucket_id >= bucket_.size()) {
-        bucket_.resize(bucket_id + 1);
-      }
+    if (!request->cacheHitPrefilled(i) && !request->isDuplicate(i)) {
+      toBeFreshlyTranslated += enqueueSentence(RequestSentence(i, request));
+    }
+  }
 
-      bucket_[bucket_id].insert(sentence);
-      maxActiveBucketLength_ = std::max<size_t>(bucket_id, maxActiveBucketLength_);
+  return toBeFreshlyTranslated;
+}
 
-      toBeFreshlyTranslated += 1;
+size_t BatchingPool::enqueueSentence(const RequestSentence &sentence) {
+  if (!sentence.acquire()) {
+    // An identical sentence is already queued or being translated, this one completes along with it.
+    return 0;
+  }
+  insertSentence(sentence);
+  return 1;
+}
+
+void BatchingPool::insertSentence(const RequestSentence &sentence) {
+  size_t bucket_id = sentence.numTokens();
+
+  // Due to a workaround for pivoting, unless we can discipline the
+  // vocabulary to get stronger static requirements, it is difficult to
+  // rework the rest of the components. Instead, we allow dynamic growth
+  // here. We let std::vector take care of the dynamic growth.
+  // https://en.cppreference.com/w/cpp/container/vector/resize#Complexity
+  if (bucket_id >= bucket_.size()) {
+    bucket_.resize(bucket_id + 1);
+  }
+
+  const Request *request = sentence.request().get();
+  if (lastRequest_ >= requests_.size() || requests_[lastRequest_].request.get() != request) {
+    auto [found, inserted] = requestSlots_.try_emplace(request, 0);
+    if (inserted) {
+      if (!freeRequests_.empty()) {
+        found->second = freeRequests_.back();
+        freeRequests_.pop_back();
+      } else {
+        ABORT_IF(requests_.size() >= std::numeric_limits<uint32_t>::max(), "Fatal: too many requests pending");
+        found->second = requests_.size();
+        requests_.emplace_back();
+      }
+      requests_[found->second] =
+          RequestSlot{sentence.request(), sentence.request()->id(), sentence.schedule().deadline, 0};
     }
+    lastRequest_ = found->second;
   }
+  requests_[lastRequest_].pending++;
 
-  return toBeFreshlyTranslated;
+  const size_t cls = static_cast<size_t>(sentence.schedule().priority);
+  bucket_[bucket_id][cls].insert(SentenceHandle{lastRequest_, static_cast<uint32_t>(sentence.index())},
+                                 [this](SentenceHandle a, SentenceHandle b) { return less(a, b); });
+  pendingTokens_ += bucket_id;
+  maxActiveBucketLength_ = std::max<size_t>(bucket_id, maxActiveBucketLength_);
 }
 
 void BatchingPool::clear() {
   for (size_t length = 0; length < bucket_.size(); length++) {
-    bucket_[length].clear();
+    for (auto &queue : bucket_[length]) {
+      queue.clear();
+    }
   }
+  requests_.clear();
+  freeRequests_.clear();
+  requestSlots_.clear();
+  pendingTokens_ = 0;
 }
 
 }  // namespace bergamot
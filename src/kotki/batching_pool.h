@@ -1,7 +1,12 @@
 #ifndef SRC_BERGAMOT_BATCHING_POOL_H_
 #define SRC_BERGAMOT_BATCHING_POOL_H_
 
-#include <set>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "kotki/batch.h"
@@ -13,27 +18,171 @@
 namespace marian {
 namespace bergamot {
 
+// A pending sentence: slot of its Request in the pool's request arena, and its index in that Request.
+struct SentenceHandle {
+  uint32_t request;
+  uint32_t index;
+};
+
+// Sentences of one length and Priority, most urgent first by the comparison less. Sentences mostly arrive in that
+// order (request after request, segment after segment) and are appended to a ring buffer; those that don't (an earlier
+// deadline, a pivot's second hop finishing out of order) go into a binary heap. front() is the more urgent of both
+// fronts, so inserting costs O(1), at worst O(log n). Storage grows by doubling and is reused, so a steady stream of
+// sentences allocates nothing.
+class SentenceQueue {
+ public:
+  bool empty() const { return size_ == 0 && heap_.empty(); }
+  size_t size() const { return size_ + heap_.size(); }
+
+  template <class Less>
+  SentenceHandle front(Less less) const {
+    return fromHeap(less) ? heap_.front() : handles_[head_];
+  }
+
+  template <class Less>
+  void pop(Less less) {
+    if (fromHeap(less)) {
+      std::pop_heap(heap_.begin(), heap_.end(), [&less](SentenceHandle a, SentenceHandle b) { return less(b, a); });
+      heap_.pop_back();
+    } else {
+      head_ = (head_ + 1) & (handles_.size() - 1);
+      size_--;
+    }
+  }
+
+  template <class Less>
+  void insert(SentenceHandle handle, Less less) {
+    if (size_ > 0 && less(handle, at(size_ - 1))) {
+      heap_.push_back(handle);
+      std::push_heap(heap_.begin(), heap_.end(), [&less](SentenceHandle a, SentenceHandle b) { return less(b, a); });
+      return;
+    }
+    if (size_ == handles_.size()) {
+      grow();
+    }
+    at(size_) = handle;
+    size_++;
+  }
+
+  void clear() {
+    head_ = size_ = 0;
+    heap_.clear();
+  }
+
+ private:
+  template <class Less>
+  bool fromHeap(Less less) const {
+    return size_ == 0 || (!heap_.empty() && less(heap_.front(), handles_[head_]));
+  }
+
+  SentenceHandle &at(size_t i) { return handles_[(head_ + i) & (handles_.size() - 1)]; }
+
+  void grow() {
+    std::vector<SentenceHandle> handles(std::max<size_t>(2 * handles_.size(), 8));
+    for (size_t i = 0; i < size_; i++) {
+      handles[i] = at(i);
+    }
+    handles_.swap(handles);
+    head_ = 0;
+  }
+
+  std::vector<SentenceHandle> handles_;  // ring buffer, capacity is a power of 2
+  size_t head_{0};
+  size_t size_{0};
+  std::vector<SentenceHandle> heap_;  // min-heap (by less) of the sentences that arrived out of order
+};
+
 class BatchingPool {
  public:
   explicit BatchingPool(Ptr<Options> options);
 
-  // RequestSentence incorporates (tentative) notions of priority with each
-  // sentence. This method inserts the sentence into the internal data-structure
-  // which maintains priority among sentences from multiple concurrent requests.
+  // Inserts the sentences of request, ordered among those of other requests by
+  // its Schedule (see less).
   size_t enqueueRequest(Ptr<Request> request);
 
-  // Loads sentences with sentences compiled from (tentatively) multiple
-  // requests optimizing for both padding and priority.
+  // Inserts a single sentence, for requests whose segments become available one
+  // at a time (see Request::provideSegment).
+  size_t enqueueSentence(const RequestSentence &sentence);
+
+  // Inserts a sentence RequestSentence::acquire() was already called for.
+  void insertSentence(const RequestSentence &sentence);
+
+  // Loads batch with sentences compiled from (potentially) multiple requests.
+  // The most urgent pending sentence is always included, along with sentences of
+  // its priority class close to it in length (see planBatch). Less urgent
+  // sentences fill up what the batch width leaves unused.
   size_t generateBatch(Batch &batch);
 
   // Removes any pending requests from the pool.
   void clear();
 
+  // Tokens of all sentences waiting to be batched.
+  size_t pendingTokens() const { return pendingTokens_; }
+
+  // Largest number of tokens in one batch (mini-batch-words).
+  size_t miniBatchWords() const { return miniBatchWords_; }
+
  private:
+  static constexpr size_t numPriorities = static_cast<size_t>(Priority::bulk) + 1;
+
   size_t miniBatchWords_;
-  std::vector<std::set<RequestSentence>> bucket_;
+  // Padded tokens worth saving to translate one more batch, for the fixed cost of each forward pass.
+  size_t batchOverhead_;
+  // A Request with sentences in the pool, and what ordering them needs without going through it.
+  struct RequestSlot {
+    Ptr<Request> request;
+    size_t id;
+    std::chrono::steady_clock::time_point deadline;
+    size_t pending;  // sentences of request in the pool, the slot is freed once it drops to 0
+  };
+
+  // Pending sentences by length and Priority. Their sizes are the length histogram planBatch works on.
+  std::vector<std::array<SentenceQueue, numPriorities>> bucket_;
+  // Arena of the requests with pending sentences, holding the one reference the pool keeps to each. Free slots are
+  // listed in freeRequests_ for reuse.
+  std::vector<RequestSlot> requests_;
+  std::vector<uint32_t> freeRequests_;
+  std::unordered_map<const Request *, uint32_t> requestSlots_;
+  // Slot of the last inserted Request, where the next sentence most likely belongs too.
+  uint32_t lastRequest_{0};
   size_t batchNumber_{0};
   size_t maxActiveBucketLength_;
+  size_t pendingTokens_{0};
+
+  // Splits the pending sentences of priority into batches of neighbouring lengths such that padded tokens plus
+  // batchOverhead_ per batch are fewest, by dynamic programming over the length histogram. Returns the shortest and
+  // longest length of the batch holding length anchor.
+  std::pair<size_t, size_t> planBatch(Priority priority, size_t anchor) const;
+
+  // Moves the front (most urgent) sentence of length and priority cls into batch.
+  void take(size_t length, size_t cls, Batch &batch);
+
+  // The order sentences are batched in, within one Priority (queues are per Priority, the more urgent ones drawn from
+  // first): earliest deadline first, ties go to the request which came first, sentences of one Request stay in order.
+  bool less(SentenceHandle a, SentenceHandle b) const {
+    const RequestSlot &slotA = requests_[a.request], &slotB = requests_[b.request];
+    if (slotA.deadline != slotB.deadline) {
+      return slotA.deadline < slotB.deadline;
+    }
+    if (slotA.id != slotB.id) {
+      return slotA.id < slotB.id;
+    }
+    return a.index < b.index;
+  }
+
+  // Most urgent sentence of length and priority cls, which must not be empty.
+  SentenceHandle front(size_t length, size_t cls) const {
+    return bucket_[length][cls].front([this](SentenceHandle a, SentenceHandle b) { return less(a, b); });
+  }
+
+  // Most urgent Priority with sentences of length, numPriorities if there are none.
+  size_t frontClass(size_t length) const {
+    size_t cls = 0;
+    while (cls < numPriorities && bucket_[length][cls].empty()) {
+      cls++;
+    }
+    return cls;
+  }
 };
 
 }  // namespace bergamot
@@ -1,8 +1,10 @@
 #include "kotki/byte_array_util.h"
 
 #include <cstdlib>
+#include <cstring>
 #include <memory>
 
+#include "kotki/mapped_file.h"
 #include "marian-lite/common/io.h"
 #include "marian-lite/data/shortlist.h"
 
@@ -81,7 +83,43 @@ bool validateBinaryModel(const AlignedMemory& model, uint64_t fileSize) {
   }
 }
 
+uint64_t hashBytes(const char* data, size_t size, uint64_t seed) {
+  // Fast non-cryptographic checksum for identifying model files. Four independent multiply-xor lanes over 8-byte
+  // words keep the multiplier busy, so hundreds of MB hash in a few tens of milliseconds.
+  const uint64_t prime = 0x100000001B3ULL * 0x9E3779B97F4A7C15ULL | 1;
+  uint64_t lanes[4] = {seed ^ 0x243F6A8885A308D3ULL, seed ^ 0x13198A2E03707344ULL, seed ^ 0xA4093822299F31D0ULL,
+                       seed ^ 0x082EFA98EC4E6C89ULL};
+  size_t offset = 0;
+  for (; offset + 32 <= size; offset += 32) {
+    for (size_t lane = 0; lane < 4; lane++) {
+      uint64_t word;
+      std::memcpy(&word, data + offset + lane * 8, sizeof(word));
+      lanes[lane] = (lanes[lane] ^ word) * prime;
+    }
+  }
+  uint64_t hash = size;
+  for (uint64_t lane : lanes) {
+    hash = (hash ^ (lane >> 29) ^ lane) * prime;
+  }
+  for (; offset < size; offset++) {
+    hash = (hash ^ static_cast<uint8_t>(data[offset])) * prime;
+  }
+  return hash ^ (hash >> 32);
+}
+
 AlignedMemory loadFileToMemory(const std::string& path, size_t alignment) {
+  // Map the file rather than copying it: startup doesn't wait for reading hundreds of MB, and processes loading the same
+  // model share its pages through the page-cache. Mappings are page aligned, which covers the 256 bytes the model
+  // needs. Read-only: the model, shortlist and vocabularies are only read from. Model files are to be replaced by
+  // rename rather than rewritten in place, see MappedFile.
+  auto mapping = std::make_shared<MappedFile>(path);
+  if (mapping->valid() && reinterpret_cast<uintptr_t>(mapping->begin()) % alignment == 0) {
+    char* begin = mapping->data();
+    size_t size = mapping->size();
+    return AlignedMemory(begin, size, std::move(mapping));
+  }
+
+  // Empty files, or those that can't be mapped, are read.
   uint64_t fileSize = filesystem::fileSize(path);
   io::InputFileStream in(path);
   ABORT_IF(in.bad(), "Failed opening file stream: {}", path);
@@ -165,8 +203,6 @@ MemoryBundle getMemoryBundleFromConfig(marian::Ptr<marian::Options> options) {
 AlignedMemory getSsplitPrefixFileMemoryFromConfig(marian::Ptr<marian::Options> options) {
   std::string fpath = options->get<std::string>("ssplit-prefix-file", "");
   if (!fpath.empty()) {
-    // @TODO: maybe rewrite to fetch from RAM instead, as we already have the data in nb_prefix.h
-    //        this would also get rid of writing nb_prefixes to disk.
     return loadFileToMemory(fpath, 64);
   }
   // Return empty AlignedMemory
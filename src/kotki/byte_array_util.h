@@ -13,6 +13,7 @@ AlignedMemory getSsplitPrefixFileMemoryFromConfig(marian::Ptr<marian::Options> o
 void getVocabsMemoryFromConfig(marian::Ptr<marian::Options> options,
                                std::vector<std::shared_ptr<AlignedMemory>>& vocabMemories);
 bool validateBinaryModel(const AlignedMemory& model, uint64_t fileSize);
+uint64_t hashBytes(const char* data, size_t size, uint64_t seed);
 MemoryBundle getMemoryBundleFromConfig(marian::Ptr<marian::Options> options);
 }  // namespace bergamot
 }  // namespace marian
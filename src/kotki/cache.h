@@ -1,23 +1,109 @@
 #pragma once
+#include <algorithm>
 #include <atomic>
+#include <cstdint>
+#include <utility>
 #include <memory>
 #include <mutex>
 #include <vector>
 
 #include "kotki/definitions.h"
-#include "marian-lite/translator/history.h"
 
 namespace marian::bergamot {
 
-template <class Key, class Value, class Hash = std::hash<Key>, class Equals = std::equal_to<Key>>
+/// Approximate access counts of keys: a count-min sketch of 4-bit saturating counters. Once the number of increments
+/// reaches 10x the capacity, all counters are halved so the estimates follow recent traffic. Used by AtomicCache as
+/// TinyLFU admission filter. Not synchronized, the owner is expected to serialize access.
+class FrequencySketch {
+ public:
+  explicit FrequencySketch(size_t capacity)
+      : table_(tableSize(capacity), 0), sampleSize_(10 * std::max<size_t>(capacity, 1)) {}
+
+  void increment(size_t hash) {
+    bool added = false;
+    for (size_t row = 0; row < kDepth; row++) {
+      size_t counter = counterIndex(hash, row);
+      uint64_t &word = table_[counter / kCountersPerWord];
+      size_t shift = (counter % kCountersPerWord) * 4;
+      if (((word >> shift) & 0xF) < 0xF) {
+        word += uint64_t(1) << shift;
+        added = true;
+      }
+    }
+    if (added && ++additions_ >= sampleSize_) {
+      age();
+    }
+  }
+
+  uint8_t frequency(size_t hash) const {
+    uint8_t estimate = 0xF;
+    for (size_t row = 0; row < kDepth; row++) {
+      size_t counter = counterIndex(hash, row);
+      uint64_t word = table_[counter / kCountersPerWord];
+      estimate = std::min<uint8_t>(estimate, (word >> ((counter % kCountersPerWord) * 4)) & 0xF);
+    }
+    return estimate;
+  }
+
+ private:
+  static constexpr size_t kDepth = 4;
+  static constexpr size_t kCountersPerWord = 16;
+
+  static size_t tableSize(size_t capacity) {
+    // About one counter per row and entry, rounded up to a power of two for cheap indexing.
+    size_t words = 1;
+    while (words * kCountersPerWord < capacity) {
+      words <<= 1;
+    }
+    return words;
+  }
+
+  size_t counterIndex(size_t hash, size_t row) const {
+    // splitmix64 finalizer, seeded per row to get independent positions.
+    uint64_t x = hash + (row + 1) * 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x & (table_.size() * kCountersPerWord - 1);
+  }
+
+  void age() {
+    for (auto &word : table_) {
+      word = (word >> 1) & 0x7777777777777777ULL;
+    }
+    additions_ /= 2;
+  }
+
+  std::vector<uint64_t> table_;
+  size_t sampleSize_;
+  size_t additions_{0};
+};
+
+struct CacheStats {
+  size_t hits{0};
+  size_t misses{0};
+  size_t evictions{0};  ///< stores which replaced an existing entry
+  size_t rejected{0};   ///< stores turned down by the admission filter
+};
+
+/// Fixed-size, thread-safe cache. Keys map onto a set of `Ways` records, within which the victim is picked by CLOCK
+/// (second chance). A new key only replaces the victim if the FrequencySketch estimates it is accessed more often
+/// (TinyLFU), so one-off keys cannot push out frequently hit ones.
+///
+/// Sets are guarded by `buckets` mutexes; each mutex also owns the frequency sketch for the keys of its sets.
+template <class Key, class Value, class Hash = std::hash<Key>, class Equals = std::equal_to<Key>, size_t Ways = 8>
 class AtomicCache {
  public:
-  struct Stats {
-    size_t hits{0};
-    size_t misses{0};
-  };
+  using Stats = CacheStats;
 
-  explicit AtomicCache(size_t size, size_t buckets) : records_(size), mutexBuckets_(buckets) {}
+  explicit AtomicCache(size_t size, size_t buckets)
+      : numSets_(std::max<size_t>((size + Ways - 1) / Ways, 1)),
+        records_(numSets_ * Ways),
+        hands_(numSets_, 0),
+        mutexBuckets_(std::max<size_t>(buckets, 1)),
+        sketches_(mutexBuckets_.size(), FrequencySketch(records_.size() / mutexBuckets_.size())) {
+    static_assert(Ways > 0 && Ways <= 256, "CLOCK hands are stored as uint8_t");
+  }
 
   std::pair<bool, Value> find(const Key &key) const {
     Value value;
@@ -28,64 +114,335 @@ class AtomicCache {
   void store(const Key &key, Value value) { atomicStore(key, value); }
 
   const Stats stats() const {
-#ifdef ENABLE_CACHE_STATS
-    return Stats{hits_.load(), misses_.load()};
-#else
-    ABORT("Cache statistics requested without enabling in builds. Please use -DENABLE_CACHE_STATS with cmake.");
-    return Stats{0, 0};
-#endif
+    return Stats{hits_.load(std::memory_order_relaxed), misses_.load(std::memory_order_relaxed),
+                 evictions_.load(std::memory_order_relaxed), rejected_.load(std::memory_order_relaxed)};
+  }
+
+  /// Calls visit(key, value) for every entry, one set at a time under the set's mutex.
+  template <class Visitor>
+  void forEach(Visitor visit) const {
+    for (size_t set = 0; set < numSets_; set++) {
+      std::lock_guard<std::mutex> lock(mutexBuckets_[set % mutexBuckets_.size()]);
+      for (size_t index = set * Ways; index < (set + 1) * Ways; index++) {
+        if (records_[index].occupied) {
+          visit(records_[index].key, records_[index].value);
+        }
+      }
+    }
   }
 
  private:
-  using Record = std::pair<Key, Value>;
+  struct Record {
+    Key key{};
+    Value value{};
+    bool occupied{false};
+    mutable bool referenced{false};
+  };
 
   bool atomicLoad(const Key &key, Value &value) const {
-    // No probing, direct map onto records_
-    size_t index = hash_(key) % records_.size();
-    size_t mutexId = index % mutexBuckets_.size();
+    size_t hash = hash_(key);
+    size_t set = hash % numSets_;
+    size_t mutexId = set % mutexBuckets_.size();
 
     std::lock_guard<std::mutex> lock(mutexBuckets_[mutexId]);
-    const Record &candidate = records_[index];
-    if (equals_(key, candidate.first)) {
-      value = candidate.second;
-#ifdef ENABLE_CACHE_STATS
-      ++hits_;
-#endif
-      return true;
-    } else {
-#ifdef ENABLE_CACHE_STATS
-      ++misses_;
-#endif
+    sketches_[mutexId].increment(hash);
+    for (size_t way = 0; way < Ways; way++) {
+      const Record &candidate = records_[set * Ways + way];
+      if (candidate.occupied && equals_(key, candidate.key)) {
+        value = candidate.value;
+        candidate.referenced = true;
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
     }
 
+    misses_.fetch_add(1, std::memory_order_relaxed);
     return false;
   }
 
   void atomicStore(const Key &key, Value value) {
-    // No probing, direct map onto records_
-    size_t index = hash_(key) % records_.size();
-    size_t mutexId = index % mutexBuckets_.size();
+    // Lookups already counted this key in the sketch, so stores do not increment it again.
+    size_t hash = hash_(key);
+    size_t set = hash % numSets_;
+    size_t mutexId = set % mutexBuckets_.size();
+    Record *records = &records_[set * Ways];
 
     std::lock_guard<std::mutex> lock(mutexBuckets_[mutexId]);
-    Record &candidate = records_[index];
+    Record *empty = nullptr;
+    for (size_t way = 0; way < Ways; way++) {
+      Record &candidate = records[way];
+      if (candidate.occupied && equals_(key, candidate.key)) {
+        candidate.value = std::move(value);
+        candidate.referenced = true;
+        return;
+      }
+      if (!candidate.occupied && empty == nullptr) {
+        empty = &candidate;
+      }
+    }
+
+    if (empty == nullptr) {
+      // CLOCK: sweep from the hand, giving referenced records a second chance.
+      uint8_t &hand = hands_[set];
+      while (records[hand].referenced) {
+        records[hand].referenced = false;
+        hand = (hand + 1) % Ways;
+      }
+      Record &victim = records[hand];
+      hand = (hand + 1) % Ways;
 
-    candidate.first = key;
-    candidate.second = value;
+      const FrequencySketch &sketch = sketches_[mutexId];
+      if (sketch.frequency(hash) <= sketch.frequency(hash_(victim.key))) {
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      evictions_.fetch_add(1, std::memory_order_relaxed);
+      empty = &victim;
+    }
+
+    empty->key = key;
+    empty->value = std::move(value);
+    empty->occupied = true;
+    empty->referenced = false;
   }
 
+  size_t numSets_;
   std::vector<Record> records_;
+  std::vector<uint8_t> hands_;
 
   mutable std::vector<std::mutex> mutexBuckets_;
+  mutable std::vector<FrequencySketch> sketches_;
 
-#ifdef ENABLE_CACHE_STATS
   mutable std::atomic<size_t> hits_{0};
   mutable std::atomic<size_t> misses_{0};
-#endif
+  std::atomic<size_t> evictions_{0};
+  std::atomic<size_t> rejected_{0};
 
   Hash hash_;
   Equals equals_;
 };
 
-typedef AtomicCache<size_t, Ptr<History>> TranslationCache;
+/// Read-mostly variant of AtomicCache with the same set-associative layout, whose lookups take no lock.
+///
+/// Records are immutable heap entries published through atomic pointers. A store swaps in a fresh entry under the
+/// set's mutex and retires the old one; retired entries are freed once no reader which could still see them is active
+/// (epoch-based reclamation, readers announce the epoch they started in through one of kMaxReaders slots).
+///
+/// Hits only set the CLOCK reference bit. The TinyLFU sketch is fed from store(), i.e. it counts misses, which keeps
+/// the read path free of shared writes other than the reader slot.
+template <class Key, class Value, class Hash = std::hash<Key>, class Equals = std::equal_to<Key>, size_t Ways = 8>
+class RcuCache {
+ public:
+  using Stats = CacheStats;
+
+  explicit RcuCache(size_t size, size_t buckets)
+      : numSets_(std::max<size_t>((size + Ways - 1) / Ways, 1)),
+        slots_(numSets_ * Ways),
+        referenced_(numSets_ * Ways),
+        hands_(numSets_, 0),
+        mutexBuckets_(std::max<size_t>(buckets, 1)),
+        sketches_(mutexBuckets_.size(), FrequencySketch(slots_.size() / mutexBuckets_.size())),
+        readers_(kMaxReaders) {
+    static_assert(Ways > 0 && Ways <= 256, "CLOCK hands are stored as uint8_t");
+    for (size_t i = 0; i < slots_.size(); i++) {
+      slots_[i].store(nullptr, std::memory_order_relaxed);
+      referenced_[i].store(false, std::memory_order_relaxed);
+    }
+  }
+
+  RcuCache(const RcuCache &) = delete;
+  RcuCache &operator=(const RcuCache &) = delete;
+
+  ~RcuCache() {
+    for (auto &slot : slots_) {
+      delete slot.load(std::memory_order_relaxed);
+    }
+    for (auto &retired : retired_) {
+      delete retired.first;
+    }
+  }
+
+  std::pair<bool, Value> find(const Key &key) const {
+    size_t set = hash_(key) % numSets_;
+    std::pair<bool, Value> result{false, Value()};
+
+    size_t reader = enter();
+    for (size_t way = 0; way < Ways; way++) {
+      size_t index = set * Ways + way;
+      const Entry *entry = slots_[index].load(std::memory_order_seq_cst);
+      if (entry != nullptr && equals_(key, entry->key)) {
+        result = std::make_pair(true, entry->value);
+        if (!referenced_[index].load(std::memory_order_relaxed)) {
+          referenced_[index].store(true, std::memory_order_relaxed);
+        }
+        break;
+      }
+    }
+    leave(reader);
+
+    (result.first ? readers_[reader].hits : readers_[reader].misses).fetch_add(1, std::memory_order_relaxed);
+    return result;
+  }
+
+  void store(const Key &key, Value value) {
+    size_t hash = hash_(key);
+    size_t set = hash % numSets_;
+    size_t mutexId = set % mutexBuckets_.size();
+    size_t first = set * Ways;
+
+    Entry *entry = nullptr;
+    Entry *replaced = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutexBuckets_[mutexId]);
+      FrequencySketch &sketch = sketches_[mutexId];
+      sketch.increment(hash);
+
+      size_t target = first + Ways;
+      for (size_t index = first; index < first + Ways; index++) {
+        Entry *candidate = slots_[index].load(std::memory_order_relaxed);
+        if (candidate != nullptr && equals_(key, candidate->key)) {
+          target = index;
+          break;
+        }
+        if (candidate == nullptr && target == first + Ways) {
+          target = index;
+        }
+      }
+
+      if (target == first + Ways) {
+        // CLOCK: sweep from the hand, giving referenced records a second chance.
+        // Readers may set bits again behind the hand, so give up on second chances after two sweeps.
+        uint8_t &hand = hands_[set];
+        for (size_t step = 0; step < 2 * Ways && referenced_[first + hand].exchange(false, std::memory_order_relaxed);
+             step++) {
+          hand = (hand + 1) % Ways;
+        }
+        target = first + hand;
+        hand = (hand + 1) % Ways;
+
+        Entry *victim = slots_[target].load(std::memory_order_relaxed);
+        if (sketch.frequency(hash) <= sketch.frequency(hash_(victim->key))) {
+          rejected_.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      entry = new Entry{key, std::move(value)};
+      referenced_[target].store(false, std::memory_order_relaxed);
+      replaced = slots_[target].exchange(entry, std::memory_order_seq_cst);
+    }
+
+    if (replaced != nullptr) {
+      retire(replaced);
+    }
+  }
+
+  const Stats stats() const {
+    Stats stats{0, 0, evictions_.load(std::memory_order_relaxed), rejected_.load(std::memory_order_relaxed)};
+    for (auto &reader : readers_) {
+      stats.hits += reader.hits.load(std::memory_order_relaxed);
+      stats.misses += reader.misses.load(std::memory_order_relaxed);
+    }
+    return stats;
+  }
+
+  /// Calls visit(key, value) for every entry. Runs as a reader, concurrent stores may or may not be seen.
+  template <class Visitor>
+  void forEach(Visitor visit) const {
+    size_t reader = enter();
+    for (auto &slot : slots_) {
+      const Entry *entry = slot.load(std::memory_order_seq_cst);
+      if (entry != nullptr) {
+        visit(entry->key, entry->value);
+      }
+    }
+    leave(reader);
+  }
+
+ private:
+  static constexpr size_t kMaxReaders = 256;
+  static constexpr size_t kReclaimThreshold = 64;
+
+  struct Entry {
+    Key key;
+    Value value;
+  };
+
+  /// Epoch a reader started in (0 when idle), plus its share of the statistics to avoid a contended shared counter.
+  struct alignas(64) ReaderSlot {
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> misses{0};
+  };
+
+  size_t enter() const {
+    static std::atomic<size_t> threads{0};
+    thread_local size_t preferred = threads.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+    for (size_t i = preferred;; i++) {
+      size_t reader = i % readers_.size();
+      uint64_t idle = 0;
+      if (readers_[reader].epoch.compare_exchange_strong(idle, epoch, std::memory_order_seq_cst)) {
+        return reader;
+      }
+    }
+  }
+
+  void leave(size_t reader) const { readers_[reader].epoch.store(0, std::memory_order_release); }
+
+  void retire(Entry *entry) {
+    std::lock_guard<std::mutex> lock(retireMutex_);
+    retired_.emplace_back(entry, epoch_.fetch_add(1, std::memory_order_seq_cst));
+    if (retired_.size() < kReclaimThreshold) {
+      return;
+    }
+
+    // Entries retired in an epoch older than the one every active reader started in are unreachable.
+    uint64_t oldestActive = UINT64_MAX;
+    for (auto &reader : readers_) {
+      uint64_t epoch = reader.epoch.load(std::memory_order_seq_cst);
+      if (epoch != 0) {
+        oldestActive = std::min(oldestActive, epoch);
+      }
+    }
+    auto reclaimable = std::partition(retired_.begin(), retired_.end(),
+                                      [oldestActive](const auto &retired) { return retired.second >= oldestActive; });
+    for (auto it = reclaimable; it != retired_.end(); ++it) {
+      delete it->first;
+    }
+    retired_.erase(reclaimable, retired_.end());
+  }
+
+  size_t numSets_;
+  std::vector<std::atomic<Entry *>> slots_;
+  mutable std::vector<std::atomic<bool>> referenced_;
+  std::vector<uint8_t> hands_;
+
+  std::vector<std::mutex> mutexBuckets_;
+  std::vector<FrequencySketch> sketches_;
+
+  mutable std::vector<ReaderSlot> readers_;
+  std::atomic<uint64_t> epoch_{1};
+  std::mutex retireMutex_;
+  std::vector<std::pair<Entry *, uint64_t>> retired_;
+
+  std::atomic<size_t> evictions_{0};
+  std::atomic<size_t> rejected_{0};
+
+  Hash hash_;
+  Equals equals_;
+};
+
+/// TranslationCache holds decoded sentences keyed by hashForCache. DocumentCache holds whole-input translations keyed
+/// on the raw input bytes, and is consulted before any sentence splitting or encoding.
+#ifdef LOCKFREE_CACHE
+typedef RcuCache<size_t, Ptr<const TranslatedSentence>> TranslationCache;
+typedef RcuCache<size_t, Ptr<const std::string>> DocumentCache;
+#else
+typedef AtomicCache<size_t, Ptr<const TranslatedSentence>> TranslationCache;
+typedef AtomicCache<size_t, Ptr<const std::string>> DocumentCache;
+#endif
 
 }  // namespace marian::bergamot
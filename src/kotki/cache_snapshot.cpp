@@ -0,0 +1,122 @@
+#include "kotki/cache_snapshot.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "marian-lite/common/logging.h"
+
+namespace marian {
+namespace bergamot {
+
+namespace {
+
+const uint64_t SNAPSHOT_MAGIC = 0x48534143494B544BULL;  // "KTKICACH"
+const uint64_t SNAPSHOT_VERSION = 2;
+
+struct SnapshotHeader {
+  uint64_t magic;
+  uint64_t version;
+  uint64_t cacheNamespace;
+  uint64_t numEntries;
+  uint64_t offsetsOffset;
+  uint64_t textOffset;
+};
+
+struct SnapshotEntry {
+  uint64_t key;
+  uint64_t offsetsBegin;  // index into tokenOffsets[]
+  uint64_t textBegin;     // index into text[]
+  uint32_t numOffsets;
+  uint32_t textBytes;
+};
+
+}  // namespace
+
+size_t saveCacheSnapshot(const TranslationCache &cache, uint64_t cacheNamespace, const std::string &path) {
+  std::vector<SnapshotEntry> entries;
+  std::vector<uint32_t> offsets;
+  std::string text;
+  cache.forEach([&](const size_t &key, const Ptr<const TranslatedSentence> &translation) {
+    entries.push_back(SnapshotEntry{key, offsets.size(), text.size(),
+                                    static_cast<uint32_t>(translation->tokenOffsets.size()),
+                                    static_cast<uint32_t>(translation->text.size())});
+    offsets.insert(offsets.end(), translation->tokenOffsets.begin(), translation->tokenOffsets.end());
+    text += translation->text;
+  });
+
+  uint64_t offsetsOffset = sizeof(SnapshotHeader) + entries.size() * sizeof(SnapshotEntry);
+  SnapshotHeader header{SNAPSHOT_MAGIC, SNAPSHOT_VERSION, cacheNamespace, entries.size(), offsetsOffset,
+                        offsetsOffset + offsets.size() * sizeof(uint32_t)};
+
+  // Write next to the destination and rename, so readers never map a half-written snapshot. Snapshots are written
+  // while unloading and shutting down, a read-only or full disk only costs the warm start.
+  std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      LOG(warn, "Failed opening cache snapshot {} for writing, skipped", tmpPath);
+      return 0;
+    }
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(SnapshotEntry));
+    out.write(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(uint32_t));
+    out.write(text.data(), text.size());
+    out.close();
+    if (!out) {
+      LOG(warn, "Failed writing cache snapshot {}, skipped", tmpPath);
+      std::remove(tmpPath.c_str());
+      return 0;
+    }
+  }
+  if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    LOG(warn, "Failed moving cache snapshot into place at {}, skipped", path);
+    std::remove(tmpPath.c_str());
+    return 0;
+  }
+  return entries.size();
+}
+
+size_t loadCacheSnapshot(const MappedFile &snapshot, uint64_t cacheNamespace, TranslationCache &cache) {
+  if (!snapshot.valid() || snapshot.size() < sizeof(SnapshotHeader)) {
+    return 0;
+  }
+
+  SnapshotHeader header;
+  std::memcpy(&header, snapshot.begin(), sizeof(header));
+  if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION || header.cacheNamespace != cacheNamespace) {
+    return 0;
+  }
+
+  // Reject truncated files rather than reading past the mapping.
+  if (header.offsetsOffset != sizeof(SnapshotHeader) + header.numEntries * sizeof(SnapshotEntry) ||
+      header.textOffset < header.offsetsOffset || header.textOffset > snapshot.size() ||
+      (header.textOffset - header.offsetsOffset) % sizeof(uint32_t) != 0) {
+    return 0;
+  }
+  size_t numOffsets = (header.textOffset - header.offsetsOffset) / sizeof(uint32_t);
+  size_t textBytes = snapshot.size() - header.textOffset;
+
+  // mmap is page aligned, the header and entries are multiples of 8 bytes: the arrays are suitably aligned.
+  const auto *entries = reinterpret_cast<const SnapshotEntry *>(snapshot.begin() + sizeof(SnapshotHeader));
+  const auto *offsets = reinterpret_cast<const uint32_t *>(snapshot.begin() + header.offsetsOffset);
+  const char *text = snapshot.begin() + header.textOffset;
+
+  size_t restored = 0;
+  for (size_t i = 0; i < header.numEntries; i++) {
+    const SnapshotEntry &entry = entries[i];
+    if (entry.offsetsBegin + entry.numOffsets > numOffsets || entry.textBegin + entry.textBytes > textBytes) {
+      continue;
+    }
+    auto translation = New<TranslatedSentence>();
+    translation->text.assign(text + entry.textBegin, entry.textBytes);
+    translation->tokenOffsets.assign(offsets + entry.offsetsBegin, offsets + entry.offsetsBegin + entry.numOffsets);
+    cache.store(entry.key, translation);
+    restored++;
+  }
+  return restored;
+}
+
+}  // namespace bergamot
+}  // namespace marian
@@ -0,0 +1,39 @@
+#ifndef SRC_BERGAMOT_CACHE_SNAPSHOT_H_
+#define SRC_BERGAMOT_CACHE_SNAPSHOT_H_
+
+#include <string>
+
+#include "kotki/cache.h"
+#include "kotki/definitions.h"
+#include "kotki/mapped_file.h"
+
+namespace marian {
+namespace bergamot {
+
+/// A cache snapshot persists the decoded translation of every TranslationCache entry, so a restarted process can
+/// serve repeated sentences without translating them again. Layout (native endianness, all offsets in bytes):
+///
+/// ```
+///   SnapshotHeader
+///   SnapshotEntry[numEntries]           key, position and length of its token offsets and text
+///   uint32_t tokenOffsets[]             TranslatedSentence::tokenOffsets of all entries, back to back
+///   char text[]                         TranslatedSentence::text of all entries, back to back
+/// ```
+///
+/// Keys are hashForCache values, which are only meaningful for the model they were computed with. The header
+/// therefore records the cache namespace (TranslationModel::cacheNamespace()), and snapshots of another namespace
+/// are ignored on load.
+
+/// Writes all entries of cache to path, replacing an existing snapshot atomically. Failures are logged, the existing
+/// snapshot (if any) is then left in place.
+/// @returns number of entries written, 0 on failure.
+size_t saveCacheSnapshot(const TranslationCache &cache, uint64_t cacheNamespace, const std::string &path);
+
+/// Restores the entries of a mapped snapshot into cache, if the snapshot belongs to cacheNamespace.
+/// @returns number of entries restored.
+size_t loadCacheSnapshot(const MappedFile &snapshot, uint64_t cacheNamespace, TranslationCache &cache);
+
+}  // namespace bergamot
+}  // namespace marian
+
+#endif  // SRC_BERGAMOT_CACHE_SNAPSHOT_H_
@@ -1,6 +1,10 @@
 #ifndef SRC_BERGAMOT_DEFINITIONS_H_
 #define SRC_BERGAMOT_DEFINITIONS_H_
 
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "kotki/aligned.h"
@@ -52,6 +56,18 @@ struct SubwordRange {
   bool operator==(SubwordRange other) const { return begin == other.begin && end == other.end; }
 };
 
+/// One-best translation of a single sentence, already decoded: the target text and the boundaries of its subword
+/// tokens. This is all ResponseBuilder needs of a translated sentence, which makes it a far more compact cache value
+/// than the beam-search History it is decoded from.
+struct TranslatedSentence {
+  std::string text;
+
+  /// Token i spans [tokenOffsets[i], tokenOffsets[i + 1]) in text. Empty for a sentence without tokens.
+  std::vector<uint32_t> tokenOffsets;
+
+  size_t numTokens() const { return tokenOffsets.empty() ? 0 : tokenOffsets.size() - 1; }
+};
+
 class Response;
 using CallbackType = std::function<void(Response &&)>;
 
@@ -12,19 +12,334 @@
 #include "kotki/utils.h"
 
 string KotkiTranslationModel::translate(string input) {
-  if(!initialized) { this->load(); }
+  std::promise<string> resultPromise;
+  std::future<string> resultFuture = resultPromise.get_future();
+  this->translate(std::move(input), [&resultPromise](string &&result) {
+    resultPromise.set_value(std::move(result));
+  });
+  return resultFuture.get();
+}
 
-  Batch batch;
-  marian::Ptr<Request> request = model->makeRequest(std::move(input), m_cache);
+void KotkiTranslationModel::translate(string input, TranslationCallback callback, Schedule schedule) {
+  this->acquire();
+  auto finished = std::make_shared<std::promise<void>>();
+  std::future<void> completion = finished->get_future();
+  TranslationCallback done = [this, callback = std::move(callback), finished](string &&result) {
+    callback(std::move(result));
+    this->release();
+    finished->set_value();
+  };
+
+  size_t key = 0;
+  if(m_documentCache) {
+    key = this->documentKey(input);
+    string result;
+    if(this->findDocument(key, result)) {
+      done(std::move(result));
+      return;
+    }
+  }
 
+  marian::Ptr<Request> request =
+      model->makeRequest(std::move(input), m_cache, this->storeDocument(key, std::move(done)), schedule);
   model->enqueueRequest(request);
-  model->generateBatch(batch);
-  model->translateBatch(0, batch);
 
-  return request->response.target.text;
+  // without workers, the calling thread translates (and thus triggers the callback) itself, batch after batch until
+  // the whole input is done
+  if(workers_.empty()) {
+    drain(completion, {this});
+  }
+}
+
+void KotkiTranslationModel::translatePivot(string input, TranslationCallback callback,
+                                           vector<pair<KotkiTranslationModel*, TranslationCallback>> seconds,
+                                           Schedule schedule) {
+  this->acquire();
+
+  // complete once the first hop and every second one issued their callbacks
+  auto remaining = std::make_shared<std::atomic<size_t>>(1 + seconds.size());
+  auto finished = std::make_shared<std::promise<void>>();
+  std::future<void> completion = finished->get_future();
+  auto arrive = [remaining, finished]() {
+    if(--*remaining == 0) { finished->set_value(); }
+  };
+
+  vector<PivotTarget> targets;
+  vector<KotkiTranslationModel*> models = {this};
+  for(auto &[second, secondCallback]: seconds) {
+    second->acquire();
+    models.push_back(second);
+    targets.push_back(PivotTarget{
+        second->model, second->m_cache,
+        [second = second, secondCallback, arrive](Response &&response) {
+          secondCallback(std::move(response.target.text));
+          second->release();
+          arrive();
+        }});
+  }
+
+  CallbackType firstCallback = [this, callback, arrive](Response &&response) {
+    if(callback) { callback(std::move(response.target.text)); }
+    this->release();
+    arrive();
+  };
+
+  marian::Ptr<Request> request =
+      model->makePivotRequest(std::move(input), m_cache, std::move(targets), firstCallback, schedule);
+  model->enqueueRequest(request);
+
+  // without workers, sentences of the second hops are queued as the first hop finishes them, draw from all models
+  if(workers_.empty()) {
+    drain(completion, models);
+  }
+}
+
+vector<string> KotkiTranslationModel::translate(vector<string> inputs, Schedule schedule) {
+  this->acquire();
+
+  // enqueue everything first, so sentences of different inputs end up in the same batches
+  vector<std::promise<string>> resultPromises(inputs.size());
+  auto remaining = std::make_shared<std::atomic<size_t>>(inputs.size());
+  auto finished = std::make_shared<std::promise<void>>();
+  std::future<void> completion = finished->get_future();
+  if(inputs.empty()) { finished->set_value(); }
+  for(size_t i = 0; i < inputs.size(); i++) {
+    auto &resultPromise = resultPromises[i];
+    auto callback = [&resultPromise, remaining, finished](string &&result) {
+      resultPromise.set_value(std::move(result));
+      if(--*remaining == 0) { finished->set_value(); }
+    };
+
+    size_t key = 0;
+    if(m_documentCache) {
+      key = this->documentKey(inputs[i]);
+      string result;
+      if(this->findDocument(key, result)) {
+        callback(std::move(result));
+        continue;
+      }
+    }
+
+    auto request = model->makeRequest(std::move(inputs[i]), m_cache, this->storeDocument(key, callback), schedule);
+    model->enqueueRequest(request);
+  }
+
+  if(workers_.empty()) {
+    drain(completion, {this});
+  }
+
+  vector<string> results;
+  results.reserve(resultPromises.size());
+  for(auto &resultPromise: resultPromises) {
+    results.emplace_back(resultPromise.get_future().get());
+  }
+  this->release();
+  return results;
+}
+
+size_t KotkiTranslationModel::documentKey(const string &input) const {
+  return marian::bergamot::hashBytes(input.data(), input.size(), model->cacheNamespace());
+}
+
+bool KotkiTranslationModel::findDocument(size_t key, string &result) {
+  auto [found, document] = m_documentCache->find(key);
+  if(found) { result = *document; }
+  return found;
+}
+
+CallbackType KotkiTranslationModel::storeDocument(size_t key, TranslationCallback callback) {
+  // key is only meaningful with a document cache, keep the plain callback otherwise
+  if(!m_documentCache) {
+    return [callback](Response &&response) { callback(std::move(response.target.text)); };
+  }
+  return [this, key, callback](Response &&response) {
+    m_documentCache->store(key, marian::New<const string>(response.target.text));
+    callback(std::move(response.target.text));
+  };
+}
+
+map<string, size_t> KotkiTranslationModel::stats() {
+  map<string, size_t> data;
+  if(!this->acquireLoaded()) { return data; }
+
+  // sentences repeated within an input, translated once regardless of caching
+  data["duplicates"] = model->duplicateSentences();
+  // padded_tokens - tokens is what batching wasted on padding
+  auto batches = model->batchTotals();
+  data["batches"] = batches.batches;
+  data["batch_sentences"] = batches.sentences;
+  data["batch_tokens"] = batches.tokens;
+  data["batch_padded_tokens"] = batches.paddedTokens;
+  if(m_cache) {
+    auto stats = m_cache->stats();
+    data["hits"] = stats.hits;
+    data["misses"] = stats.misses;
+    data["evictions"] = stats.evictions;
+    data["rejected"] = stats.rejected;
+  }
+  if(m_documentCache) {
+    auto documentStats = m_documentCache->stats();
+    data["document_hits"] = documentStats.hits;
+    data["document_misses"] = documentStats.misses;
+    data["document_evictions"] = documentStats.evictions;
+    data["document_rejected"] = documentStats.rejected;
+  }
+
+  this->release();
+  return data;
+}
+
+const KotkiCacheConfig &KotkiTranslationModel::cacheConfig() const {
+  const auto &kotkiConfig = this->kotki_->config;
+  return kotkiConfig.modelCaches.count(name) ? kotkiConfig.modelCaches.at(name) : kotkiConfig.cache;
+}
+
+string KotkiTranslationModel::cacheSnapshotPath() const {
+  return (fs::path(cacheConfig().snapshotDir) / (name + ".cache")).string();
+}
+
+void KotkiTranslationModel::attachCacheSnapshot() {
+  // map it now, the entries are restored once load() knows the model checksum
+  if(!cacheConfig().enabled || cacheConfig().snapshotDir.empty()) { return; }
+  cacheSnapshot_ = MappedFile(cacheSnapshotPath());
+}
+
+size_t KotkiTranslationModel::saveCacheSnapshot() {
+  if(!this->acquireLoaded()) { return 0; }
+  size_t saved = this->writeCacheSnapshot();
+  this->release();
+  return saved;
+}
+
+size_t KotkiTranslationModel::handOverCacheSnapshot() {
+  // not while unload() writes it, afterwards the replacement owns the file
+  std::lock_guard<std::mutex> lock(loadMutex_);
+  size_t saved = initialized ? this->writeCacheSnapshot() : 0;
+  ownsCacheSnapshot_ = false;
+  return saved;
+}
+
+size_t KotkiTranslationModel::writeCacheSnapshot() {
+  if(!m_cache || cacheConfig().snapshotDir.empty() || !ownsCacheSnapshot_) { return 0; }
+  // runs while unloading and from destructors, a directory that can't be created skips the snapshot
+  std::error_code error;
+  fs::create_directories(cacheConfig().snapshotDir, error);
+  if(error) {
+    std::cerr << "Skipping cache snapshot of " << name << ", can't create " << cacheConfig().snapshotDir << ": "
+              << error.message() << "\n";
+    return 0;
+  }
+  return marian::bergamot::saveCacheSnapshot(*m_cache, model->cacheNamespace(), cacheSnapshotPath());
+}
+
+void KotkiTranslationModel::acquire() {
+  // announce first and check second, unload() does the reverse: either it sees this user, or this sees the model
+  // unloading and waits for the lock
+  ++users_;
+  lastUsed_ = std::chrono::steady_clock::now().time_since_epoch().count();
+  if(initialized) { return; }
+
+  bool loaded = false;
+  {
+    std::lock_guard<std::mutex> lock(loadMutex_);
+    if(!initialized) {
+      this->load();
+      loaded = true;
+    }
+  }
+  if(loaded) {
+    this->kotki_->enforceMemoryBudget();
+  }
+}
+
+bool KotkiTranslationModel::acquireLoaded() {
+  ++users_;
+  if(initialized) { return true; }
+  --users_;
+  return false;
 }
 
-void KotkiTranslationModel::load() {
+void KotkiTranslationModel::release() {
+  lastUsed_ = std::chrono::steady_clock::now().time_since_epoch().count();
+  --users_;
+}
+
+bool KotkiTranslationModel::unload() {
+  // never wait for a model that is loading or unloading, whoever evicts moves on to the next one
+  std::unique_lock<std::mutex> lock(loadMutex_, std::try_to_lock);
+  if(!lock.owns_lock() || !initialized) { return false; }
+
+  initialized = false;
+  if(users_ > 0) {
+    initialized = true;
+    return false;
+  }
+
+  this->stopWorkers();
+  this->writeCacheSnapshot();
+  m_cache.reset();
+  m_documentCache.reset();
+  model.reset();
+  bytes_ = 0;
+  // the next load() restores the snapshot just written
+  this->attachCacheSnapshot();
+  return true;
+}
+
+void KotkiTranslationModel::stopWorkers() {
+  if(workers_.empty()) { return; }
+  model->shutdown();
+  for(auto &worker: workers_) {
+    worker.join();
+  }
+  workers_.clear();
+}
+
+void KotkiTranslationModel::drain(std::future<void> &completion, const vector<KotkiTranslationModel*> &models) {
+  // held here, the last callback may release a model for unload() before the batch is done with it
+  vector<shared_ptr<TranslationModel>> held;
+  for(auto *kotkiTranslationModel: models) { held.push_back(kotkiTranslationModel->model); }
+
+  Batch batch;
+  while(completion.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+    bool translated = false;
+    for(size_t i = 0; i < models.size(); i++) {
+      std::unique_lock<std::recursive_mutex> lock(models[i]->drainMutex_, std::try_to_lock);
+      if(lock.owns_lock() && held[i]->tryGenerateBatch(batch) > 0) {
+        held[i]->translateBatch(0, batch);
+        translated = true;
+      }
+    }
+    // nothing left to draw: another caller is translating the rest, or about to queue the next hop of it
+    if(!translated) {
+      completion.wait_for(std::chrono::milliseconds(1));
+    }
+  }
+}
+
+void KotkiTranslationModel::work(size_t workerId) {
+  Batch batch;
+  while(model->generateBatch(batch)) {
+    model->translateBatch(workerId, batch);
+  }
+}
+
+KotkiTranslationModel::~KotkiTranslationModel() {
+  this->stopWorkers();
+  this->saveCacheSnapshot();
+}
+
+map<string, double> KotkiTranslationModel::preload() {
+  std::lock_guard<std::mutex> lock(loadMutex_);
+  if(initialized) { return {}; }
+  return this->load(/*warmup=*/true);
+}
+
+map<string, double> KotkiTranslationModel::load(bool warmup) {
+  using namespace std::chrono;
+  map<string, double> timings;
+  auto then = steady_clock::now();
+
   auto config = parseOptionsFromString("", false);
   config->set("ssplit-mode", "paragraph");
   config->set("beam-size", "1");
@@ -39,52 +354,301 @@ void KotkiTranslationModel::load() {
   config->set("quiet-translation", "true");
   config->set("alignment", "soft");
 
-  config->set("ssplit-prefix-file", this->findNBPrefixFile());
-  auto models = std::vector<std::string>({
-      pathModel_
-  });
-  config->set("models", models);
-  config->set("gemm-precision", endsWith(models[0], "intgemm8.bin") ? "int8shiftAll" : "int8shiftAlphaAll");
+  const size_t numWorkers = this->kotki_->config.numWorkers;
+  if(numWorkers > 0 && this->kotki_->config.batchWait.count() > 0) {
+    config->set("mini-batch-wait", this->kotki_->config.batchWait.count() / 1000.0);
+    config->set("mini-batch-fill", this->kotki_->config.batchFill);
+  }
 
-  auto vocabs = std::vector<std::string>({pathVocab_, pathTrgVocab_});
-  config->set("vocabs", vocabs);
+  MemoryBundle memory;
+  if(!pathBundle_.empty()) {
+    // everything comes from one mapping, the bundle carries the options that depend on its model (gemm-precision)
+    config->set("models", std::vector<std::string>({pathBundle_}));
+    memory = loadModelBundle(pathBundle_, config);
+  } else {
+    auto models = std::vector<std::string>({
+        pathModel_
+    });
+    config->set("models", models);
+    config->set("gemm-precision", endsWith(models[0], "intgemm8.bin") ? "int8shiftAll" : "int8shiftAlphaAll");
 
-  auto shortlist = std::vector<std::string>({pathLex_,
-      "false"
-  });
-  config->set("shortlist", shortlist);
+    auto vocabs = std::vector<std::string>({pathVocab_, pathTrgVocab_});
+    config->set("vocabs", vocabs);
+
+    auto shortlist = std::vector<std::string>({pathLex_,
+        "false"
+    });
+    config->set("shortlist", shortlist);
+
+    memory = getMemoryBundleFromConfig(config);
+  }
+
+  // what stays allocated while loaded, accounted against KotkiConfig::memoryBudget
+  size_t bytes = memory.model.size() + memory.shortlist.size() + memory.qualityEstimatorMemory.size();
+  for(size_t i = 0; i < memory.vocabs.size(); i++) {
+    if(i == 0 || memory.vocabs[i] != memory.vocabs[i - 1]) { bytes += memory.vocabs[i]->size(); }
+  }
+  bytes_ = bytes + std::max<size_t>(numWorkers, 1) * TranslationModel::workspaceBytes();
 
-  model = marian::New<TranslationModel>(config);
+  // the splitter reads its prefixes straight from nb_prefix.h, nothing is written to disk for it
+  if(memory.ssplitPrefixFile.size() == 0) {
+    const string &prefixes = this->nbPrefixes();
+    memory.ssplitPrefixFile = AlignedMemory(const_cast<char *>(prefixes.data()), prefixes.size(),
+                                            std::shared_ptr<void>(const_cast<char *>(prefixes.data()), [](void *) {}));
+  }
+  model = marian::New<TranslationModel>(config, std::move(memory), std::max<size_t>(numWorkers, 1));
 
+  const auto &cacheConfig = this->cacheConfig();
+  if(cacheConfig.enabled) {
+    m_cache.emplace(cacheConfig.size, cacheConfig.mutexBuckets);
+
+    // persisted keys have to be stable across processes, derive them from the model instead of its load order
+    if(!cacheConfig.snapshotDir.empty()) {
+      model->setCacheNamespace(model->checksum());
+      loadCacheSnapshot(cacheSnapshot_, model->cacheNamespace(), *m_cache);
+      cacheSnapshot_ = MappedFile();
+    }
+  }
+  // independent of the sentence cache, whole inputs never reach it on a hit
+  if(cacheConfig.documentSize > 0) {
+    m_documentCache.emplace(cacheConfig.documentSize, cacheConfig.mutexBuckets);
+  }
+
+  timings["load"] = duration_cast<duration<double>>(steady_clock::now() - then).count();
+
+  if(warmup) {
+    // every worker has a backend of its own, build them before the workers exist to race for them
+    then = steady_clock::now();
+    for(size_t replica = 0; replica < std::max<size_t>(numWorkers, 1); replica++) {
+      model->warmup(replica);
+    }
+    timings["warmup"] = duration_cast<duration<double>>(steady_clock::now() - then).count();
+  }
+
+  for(size_t workerId = 0; workerId < numWorkers; workerId++) {
+    workers_.emplace_back(&KotkiTranslationModel::work, this, workerId);
+  }
+
+  lastUsed_ = steady_clock::now().time_since_epoch().count();
   this->initialized = true;
+  return timings;
 }
 
-string KotkiTranslationModel::findNBPrefixFile() {
-  auto fileName = "nonbreaking_prefix." + this->langFrom;
-  auto filePath = this->kotki_->kotkiCfgNbDir.string() + fileName;
-  if(fs::exists(filePath)) { return filePath; }
-  if(this->langFrom == "bg") {
-    return this->kotki_->kotkiCfgNbDir.string() + "nonbreaking_prefix.ru";  // close 'nuff
-  }
-  return this->kotki_->kotkiCfgNbDir.string() + "nonbreaking_prefix." + nb_prefix_default;
+const string &KotkiTranslationModel::nbPrefixes() const {
+  if(nb_prefix_lookup.count(this->langFrom)) { return nb_prefix_lookup.at(this->langFrom); }
+  if(this->langFrom == "bg") { return nb_prefix_lookup.at("ru"); }  // close 'nuff
+  return nb_prefix_lookup.at(nb_prefix_default);
 }
 
-Kotki::Kotki() {
-  this->ensureConfigDirectory();
-  this->ensureNBPrefixes();
+Kotki::Kotki() : Kotki(KotkiConfig{}) {}
+
+Kotki::Kotki(const KotkiConfig &config) : config(config) {
+  this->publish(Models{});
+  // only where to look, nothing is written at startup: scan() skips directories that don't exist
+  kotkiCfgDir = find_config_directory() + "/kotki";
+  kotkiCfgModelDir = kotkiCfgDir.string() + "/models/";
+  m_reaper = std::thread(&Kotki::reap, this);
+}
+
+Kotki::~Kotki() {
+  // every model goes with the last snapshot. a plain empty one takes its place, for anything still asking
+  {
+    std::lock_guard<std::mutex> lock(m_residencyMutex);
+    for(auto const& [name, kotkiTranslationModel]: this->snapshot()->models) {
+      m_retiring->push_back(kotkiTranslationModel);
+    }
+    std::atomic_store(&m_snapshot, std::make_shared<const Models>());
+  }
+
+  // translations still running hold on to their snapshots, and with them this
+  {
+    std::unique_lock<std::mutex> lock(m_retiredMutex);
+    m_reaperWake.wait(lock, [this]() { return m_liveSnapshots == 0; });
+    m_stopping = true;
+  }
+  m_reaperWake.notify_all();
+  m_reaper.join();
+
+  // deleting stops their workers and writes their cache snapshots, the warm start of the next process
+  for(auto *kotkiTranslationModel: m_retired) { delete kotkiTranslationModel; }
 }
 
 std::string Kotki::translate(string input, string language) {
-  if(!m_models.count(language)) {
+  return translateAsync(std::move(input), std::move(language)).get();
+}
+
+std::future<string> Kotki::translateAsync(string input, string language, Schedule schedule) {
+  auto resultPromise = std::make_shared<std::promise<string>>();
+  std::future<string> resultFuture = resultPromise->get_future();
+  translateAsync(std::move(input), std::move(language), [resultPromise](string &&result) {
+    resultPromise->set_value(std::move(result));
+  }, schedule);
+  return resultFuture;
+}
+
+void Kotki::translateAsync(string input, string language, TranslationCallback callback, Schedule schedule) {
+  auto models = this->snapshot();
+  auto route = models->routes.find(language);
+  if(route == models->routes.end()) {
+    std::cerr << "language << " << language << " not found\n";
+    callback("");
+    return;
+  }
+
+  // every hop of the route carries a copy of the callback, and with it the snapshot its models belong to
+  translateRoutes(std::move(input), {{route->second, [callback, models](string &&result) {
+    callback(stripLeadingDash(std::move(result)));
+  }}}, schedule);
+}
+
+void Kotki::translateRoutes(string input, vector<RouteCallback> routes, Schedule schedule) {
+  // routes starting with the same model translate it once, as do routes continuing with the same second model. the
+  // first two hops are pipelined sentence by sentence, longer routes continue once those complete.
+  map<KotkiTranslationModel*, vector<RouteCallback>> byFirst;
+  for(auto &route: routes) {
+    byFirst[route.first.front()].push_back(std::move(route));
+  }
+
+  size_t remaining = byFirst.size();
+  for(auto &[first, group]: byFirst) {
+    vector<TranslationCallback> endsAtFirst;
+    map<KotkiTranslationModel*, vector<RouteCallback>> bySecond;
+    for(auto &[route, callback]: group) {
+      if(route.size() == 1) {
+        endsAtFirst.push_back(callback);
+      } else {
+        bySecond[route[1]].push_back({vector<KotkiTranslationModel*>(route.begin() + 1, route.end()), callback});
+      }
+    }
+
+    vector<pair<KotkiTranslationModel*, TranslationCallback>> seconds;
+    for(auto &[second, continuing]: bySecond) {
+      vector<TranslationCallback> endsAtSecond;
+      vector<RouteCallback> beyondSecond;
+      for(auto &[route, callback]: continuing) {
+        if(route.size() == 1) {
+          endsAtSecond.push_back(callback);
+        } else {
+          beyondSecond.push_back({vector<KotkiTranslationModel*>(route.begin() + 1, route.end()), callback});
+        }
+      }
+      seconds.emplace_back(second, [this, endsAtSecond, beyondSecond, schedule](string &&result) {
+        if(!beyondSecond.empty()) {
+          translateRoutes(result, beyondSecond, schedule);
+        }
+        for(auto &callback: endsAtSecond) {
+          callback(string(result));
+        }
+      });
+    }
+
+    TranslationCallback firstCallback = nullptr;
+    if(!endsAtFirst.empty()) {
+      firstCallback = [endsAtFirst](string &&result) {
+        for(auto &callback: endsAtFirst) {
+          callback(string(result));
+        }
+      };
+    }
+
+    // the last group may consume the input
+    string groupInput = --remaining == 0 ? std::move(input) : input;
+    if(seconds.empty()) {
+      first->translate(std::move(groupInput), firstCallback, schedule);
+    } else {
+      first->translatePivot(std::move(groupInput), firstCallback, std::move(seconds), schedule);
+    }
+  }
+}
+
+map<string, string> Kotki::translateToMany(string input, string from, vector<string> to) {
+  auto models = this->snapshot();
+  map<string, std::future<string>> futures;
+  vector<RouteCallback> routes;
+  for(const auto &target: to) {
+    if(futures.count(target)) { continue; }
+    auto route = models->routes.find(from + target);
+    if(route == models->routes.end()) {
+      std::cerr << "language << " << from + target << " not found\n";
+      continue;
+    }
+    auto resultPromise = std::make_shared<std::promise<string>>();
+    futures[target] = resultPromise->get_future();
+    routes.emplace_back(route->second, [resultPromise](string &&result) {
+      resultPromise->set_value(stripLeadingDash(std::move(result)));
+    });
+  }
+
+  if(!routes.empty()) {
+    translateRoutes(std::move(input), std::move(routes), Schedule());
+  }
+
+  map<string, string> results;
+  for(const auto &target: to) { results[target] = ""; }
+  for(auto &[target, future]: futures) {
+    results[target] = future.get();
+  }
+  return results;
+}
+
+vector<string> Kotki::translateMany(vector<string> inputs, string language) {
+  auto models = this->snapshot();
+  auto route = models->routes.find(language);
+  if(route == models->routes.end()) {
     std::cerr << "language << " << language << " not found\n";
-    if(language.length()<4)return "";
-    string firstlang = language.substr(0,2);
-    string secondlang = language.substr(2,2);
-    if(firstlang=="en"||secondlang=="en")return "";
-    return translate(translate(input,firstlang+"en"),"en"+secondlang);
+    return vector<string>(inputs.size());
   }
 
-  auto result = m_models[language]->translate(input);
+  for(auto *hop: route->second) {
+    inputs = hop->translate(std::move(inputs), Schedule{Priority::bulk});
+  }
+  for(auto &result: inputs) {
+    result = stripLeadingDash(std::move(result));
+  }
+  return inputs;
+}
+
+// Shortest chain of models for every language pair reachable with the loaded models, by breadth-first search over a
+// graph with a node per language and an edge per model. Ties are broken in favour of pivoting through English.
+void Kotki::planRoutes(Models &models) {
+  map<string, vector<KotkiTranslationModel*>> edges;
+  for (auto const& [name, kotkiTranslationModel]: models.models) {
+    edges[kotkiTranslationModel->langFrom].push_back(kotkiTranslationModel);
+  }
+  for(auto &[lang, models]: edges) {
+    std::stable_partition(models.begin(), models.end(), [](KotkiTranslationModel *model) {
+      return model->langTo == "en";
+    });
+  }
+
+  models.routes.clear();
+  for(auto const& [from, _]: edges) {
+    // the model each language was first reached with
+    map<string, KotkiTranslationModel*> via;
+    std::deque<string> queue = {from};
+    while(!queue.empty()) {
+      string lang = queue.front();
+      queue.pop_front();
+      if(!edges.count(lang)) { continue; }
+      for(auto *model: edges[lang]) {
+        if(model->langTo == from || via.count(model->langTo)) { continue; }
+        via[model->langTo] = model;
+        queue.push_back(model->langTo);
+      }
+    }
+
+    for(auto const& [to, last]: via) {
+      vector<KotkiTranslationModel*> route = {last};
+      while(route.back()->langFrom != from) {
+        route.push_back(via[route.back()->langFrom]);
+      }
+      std::reverse(route.begin(), route.end());
+      models.routes[from + to] = std::move(route);
+    }
+  }
+}
+
+string Kotki::stripLeadingDash(string result) {
   // bug fix when result starts with '- '
   if((result.rfind("- ", 0) == 0)) {
     result = result.erase(0, 2);
@@ -94,12 +658,149 @@ std::string Kotki::translate(string input, string language) {
 
 map<string, map<string, string>> Kotki::listModels() {
   map<string, map<string, string>> data;
-  for (auto const& [name, kotkiTranslationModel]: m_models) {
+  auto snapshot = this->snapshot();
+  for (auto const& [name, kotkiTranslationModel]: snapshot->models) {
     data[name] = kotkiTranslationModel->toJson();
   }
   return data;
 }
 
+size_t Kotki::saveCaches() {
+  size_t saved = 0;
+  auto snapshot = this->snapshot();
+  for (auto const& [name, kotkiTranslationModel]: snapshot->models) {
+    saved += kotkiTranslationModel->saveCacheSnapshot();
+  }
+  return saved;
+}
+
+map<string, map<string, size_t>> Kotki::cacheStats() {
+  map<string, map<string, size_t>> data;
+  auto snapshot = this->snapshot();
+  for (auto const& [name, kotkiTranslationModel]: snapshot->models) {
+    auto stats = kotkiTranslationModel->stats();
+    if(!stats.empty()) { data[name] = std::move(stats); }
+  }
+  return data;
+}
+
+map<string, size_t> Kotki::memoryUsage() {
+  map<string, size_t> data;
+  auto snapshot = this->snapshot();
+  for (auto const& [name, kotkiTranslationModel]: snapshot->models) {
+    if(kotkiTranslationModel->initialized) { data[name] = kotkiTranslationModel->memoryUsage(); }
+  }
+  return data;
+}
+
+void Kotki::enforceMemoryBudget() {
+  if(config.memoryBudget == 0) { return; }
+  std::lock_guard<std::mutex> lock(m_residencyMutex);
+
+  size_t used = 0;
+  vector<KotkiTranslationModel*> loaded;
+  auto snapshot = this->snapshot();
+  for (auto const& [name, kotkiTranslationModel]: snapshot->models) {
+    if(!kotkiTranslationModel->initialized) { continue; }
+    used += kotkiTranslationModel->memoryUsage();
+    loaded.push_back(kotkiTranslationModel);
+  }
+
+  // least recently used first. models in use refuse to unload, the budget is exceeded rather than waited for.
+  std::sort(loaded.begin(), loaded.end(), [](KotkiTranslationModel *a, KotkiTranslationModel *b) {
+    return a->lastUsed() < b->lastUsed();
+  });
+  for(auto *kotkiTranslationModel: loaded) {
+    if(used <= config.memoryBudget) { break; }
+    const size_t bytes = kotkiTranslationModel->memoryUsage();
+    if(kotkiTranslationModel->unload()) { used -= bytes; }
+  }
+}
+
+void Kotki::released(vector<KotkiTranslationModel*> retiring) {
+  {
+    std::lock_guard<std::mutex> lock(m_retiredMutex);
+    m_retired.insert(m_retired.end(), retiring.begin(), retiring.end());
+    m_liveSnapshots--;
+  }
+  m_reaperWake.notify_all();
+}
+
+void Kotki::reap() {
+  const bool unloading = config.idleTimeout.count() > 0;
+  const auto interval = std::max<std::chrono::seconds>(config.idleTimeout / 4, std::chrono::seconds(1));
+  auto wake = [this]() { return m_stopping || !m_retired.empty(); };
+
+  std::unique_lock<std::mutex> lock(m_retiredMutex);
+  while(!m_stopping) {
+    bool woken = true;
+    if(unloading) {
+      woken = m_reaperWake.wait_for(lock, interval, wake);
+    } else {
+      m_reaperWake.wait(lock, wake);
+    }
+    vector<KotkiTranslationModel*> retired;
+    retired.swap(m_retired);
+    lock.unlock();
+
+    for(auto *kotkiTranslationModel: retired) { delete kotkiTranslationModel; }
+    if(unloading && !woken) { this->unloadIdle(); }
+    lock.lock();
+  }
+}
+
+void Kotki::unloadIdle() {
+  std::lock_guard<std::mutex> lock(m_residencyMutex);
+  const auto idleSince = std::chrono::steady_clock::now() - config.idleTimeout;
+  auto snapshot = this->snapshot();
+  for (auto const& [name, kotkiTranslationModel]: snapshot->models) {
+    if(kotkiTranslationModel->initialized && kotkiTranslationModel->lastUsed() < idleSince) {
+      kotkiTranslationModel->unload();
+    }
+  }
+}
+
+map<string, map<string, double>> Kotki::preload(vector<string> names) {
+  auto snapshot = this->snapshot();
+  vector<KotkiTranslationModel*> models;
+  if(names.empty()) {
+    for(auto const& [name, kotkiTranslationModel]: snapshot->models) { models.push_back(kotkiTranslationModel); }
+  }
+  for(const auto &name: names) {
+    auto route = snapshot->routes.find(name);
+    if(route == snapshot->routes.end()) {
+      std::cerr << "language << " << name << " not found\n";
+      continue;
+    }
+    for(auto *kotkiTranslationModel: route->second) {
+      if(std::find(models.begin(), models.end(), kotkiTranslationModel) == models.end()) {
+        models.push_back(kotkiTranslationModel);
+      }
+    }
+  }
+
+  // one model per thread at a time, models are independent of each other
+  vector<map<string, double>> timings(models.size());
+  std::atomic<size_t> next{0};
+  const size_t numThreads = std::min<size_t>(models.size(), std::max(1u, std::thread::hardware_concurrency()));
+  vector<std::thread> threads;
+  for(size_t t = 0; t < numThreads; t++) {
+    threads.emplace_back([&models, &timings, &next]() {
+      for(size_t i = next++; i < models.size(); i = next++) {
+        timings[i] = models[i]->preload();
+      }
+    });
+  }
+  for(auto &thread: threads) { thread.join(); }
+  this->enforceMemoryBudget();
+
+  map<string, map<string, double>> data;
+  for(size_t i = 0; i < models.size(); i++) {
+    if(!timings[i].empty()) { data[models[i]->name] = std::move(timings[i]); }
+  }
+  return data;
+}
+
 // Recursively search for 'registry.json'
 // - ~/.config/kotki/models/
 // - /usr/share/kotki/
@@ -146,21 +847,57 @@ int Kotki::scan(vector<filesystem::path> paths) {
     throw std::runtime_error("scan(paths) was empty");
 
   int loaded = 0;
-  for(const auto &path: paths) {
-    vector<KotkiTranslationModel*> _models = this->loadRegistry(path);
-    for(const auto &_model: _models) {
-      if(m_models.count(_model->name)) {
-        delete m_models[_model->name];
+  {
+    std::lock_guard<std::mutex> lock(m_residencyMutex);
+    // held while the replaced models are listed, they are freed once the last holder lets go of it
+    auto previous = this->snapshot();
+    Models models = *previous;
+    for(const auto &path: paths) {
+      vector<KotkiTranslationModel*> _models = this->loadRegistry(path);
+      for(const auto &_model: _models) {
+        if(models.models.count(_model->name)) {
+          m_retiring->push_back(models.models[_model->name]);
+          // the replacement restores what the outgoing model cached up to now
+          m_retiring->back()->handOverCacheSnapshot();
+        }
+
+        _model->attachCacheSnapshot();
+        models.models[_model->name] = _model;
+        loaded += 1;
       }
-
-      m_models[_model->name] = _model;
-      loaded += 1;
     }
+
+    // new translations only see the new models, those in flight finish on the ones they started with
+    planRoutes(models);
+    this->publish(std::move(models));
+  }
+
+  if(config.preload) {
+    this->preload();
   }
 
   return loaded;
 }
 
+void Kotki::publish(Models models) {
+  // the deleter runs wherever the last holder lets go, possibly in a callback on a worker of a retiring model: it
+  // leaves deleting them to m_reaper
+  auto retiring = std::make_shared<vector<KotkiTranslationModel*>>();
+  models.next = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(m_retiredMutex);
+    m_liveSnapshots++;
+  }
+  shared_ptr<const Models> snapshot(new Models(std::move(models)), [this, retiring](const Models *models) {
+    delete models;
+    this->released(std::move(*retiring));
+  });
+  m_retiring = std::move(retiring);
+  // the outgoing snapshot lists what this one replaces, an older one still held may contain those too
+  if(auto previous = this->snapshot()) { previous->next = snapshot; }
+  std::atomic_store(&m_snapshot, std::move(snapshot));
+}
+
 vector<KotkiTranslationModel*> Kotki::loadRegistry(const fs::path &regPath) {
   vector<KotkiTranslationModel*> results;
   string cwd = regPath.parent_path().string() + "/";
@@ -173,6 +910,16 @@ vector<KotkiTranslationModel*> Kotki::loadRegistry(const fs::path &regPath) {
     if(strlen(name) != 4) { continue; }
     const auto obj = group.value.GetObject();
 
+    if(obj.HasMember("bundle")) {
+      auto bundlePath = cwd + obj["bundle"]["name"].GetString();
+      if(!fs::exists(bundlePath)) {
+        std::cerr << "Skipping model " << name << " because path " << bundlePath << " does not exist\n";
+        continue;
+      }
+      results.emplace_back(new KotkiTranslationModel(name, cwd, bundlePath, this));
+      continue;
+    }
+
     string requiredErr;
     bool diffVocabs = (obj.HasMember("srcvocab")&&obj.HasMember("trgvocab"));
     for(auto const& required: {"model", "lex", !diffVocabs?"vocab":"srcvocab"}) {
@@ -224,31 +971,15 @@ vector<KotkiTranslationModel*> Kotki::loadRegistry(const fs::path &regPath) {
   return results;
 }
 
-void Kotki::ensureConfigDirectory() {
-  // create kotki data dir in ~/.config/kotki/
-  kotkiCfgDir = find_config_directory() + "/kotki";
-  kotkiCfgNbDir = kotkiCfgDir.string() + "/nb_prefixes/";
-  kotkiCfgModelDir = kotkiCfgDir.string() + "/models/";
-
-  if(!fs::is_directory(kotkiCfgDir)) {
-    fs::create_directories(kotkiCfgDir);
-  }
-  if(!fs::is_directory(kotkiCfgNbDir)) {
-    fs::create_directory(kotkiCfgNbDir);
-  }
-  if(!fs::is_directory(kotkiCfgModelDir)) {
-    fs::create_directories(kotkiCfgModelDir);
-  }
-}
-
-void Kotki::ensureNBPrefixes() const {
-  // write the 'nonbreaking_prefix files' to kotki cfg dir, marian needs them.
-  for (auto const& [lang_name, data] : nb_prefix_lookup) {
-    const auto pathDestination = kotkiCfgNbDir.string() + "nonbreaking_prefix." + lang_name;
-    std::ofstream out(pathDestination);
-    out << data;
-    out.close();
+bool Kotki::ensureConfigDirectory() {
+  // create kotki data dir in ~/.config/kotki/, e.g. to download models into
+  std::error_code error;
+  fs::create_directories(kotkiCfgModelDir, error);
+  if(error) {
+    std::cerr << "Could not create " << kotkiCfgModelDir.string() << ": " << error.message() << "\n";
+    return false;
   }
+  return true;
 }
 
 string Kotki::find_config_directory() {
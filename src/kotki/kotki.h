@@ -1,15 +1,27 @@
 #ifndef K_H
 #define K_H
 
+#include <algorithm>
+#include <chrono>
+#include <deque>
 #include <string>
 #include <filesystem>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <utility>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
 #include <regex>
+#include <thread>
 
+#include "kotki/cache_snapshot.h"
+#include "kotki/mapped_file.h"
+#include "kotki/model_bundle.h"
 #include "kotki/nb_prefix.h"
 #include "kotki/translation_model.h"
 #include "kotki/lang.h"
@@ -22,6 +34,40 @@ using namespace marian::bergamot;
 using namespace rapidjson;
 namespace fs = std::filesystem;
 
+struct KotkiCacheConfig {
+  bool enabled = false;
+  size_t size = 2000;        // number of sentence translations held
+  size_t mutexBuckets = 16;  // number of locks striped over the entries
+  // number of whole-input translations held, so an input seen before skips sentence splitting and encoding
+  // altogether. 0 disables. works with or without enabled, which only concerns the sentence cache.
+  size_t documentSize = 0;
+  // directory to persist the cache in (as '<model>.cache'), restored on the next start. empty disables.
+  // snapshots are written by Kotki::saveCaches() and when a model is unloaded.
+  string snapshotDir;
+};
+
+struct KotkiConfig {
+  // worker threads per translation model, each with its own backend replica (graph, workspace).
+  // 0 translates on the calling thread.
+  size_t numWorkers = 0;
+  // sentence-level translation cache, applied to every model unless overridden by name (e.g. 'nlen') in modelCaches
+  KotkiCacheConfig cache;
+  map<string, KotkiCacheConfig> modelCaches;
+  // load and warm up every model at the end of scan() instead of on first use, see Kotki::preload
+  bool preload = false;
+  // bytes the loaded models may take (parameters, shortlist, vocabularies, the workspace of each worker). once a load
+  // exceeds it, the least recently used idle models are unloaded. 0 keeps every model loaded.
+  size_t memoryBudget = 0;
+  // unload models which were not used for this long, 0 never does. unloaded models load again on their next use.
+  std::chrono::seconds idleTimeout{0};
+  // with numWorkers > 0, a worker holds a partial batch until batchFill (fraction of the 1024 token batch) is pending
+  // or the oldest pending sentence waited batchWait, so concurrent short requests share a pass. 0 batches right away.
+  std::chrono::microseconds batchWait{0};
+  float batchFill = 0.5;
+};
+
+using TranslationCallback = std::function<void(string &&)>;
+
 class Kotki;
 struct KotkiTranslationModel {
   // name should be 4 chars, e.g: 'nlen' (Dutch to English)
@@ -36,20 +82,64 @@ struct KotkiTranslationModel {
     langFrom = name.substr(0, 2);
     langTo = name.erase(0, 2);
   }
+  // a model packed into a single bundle file, see model_bundle.h
+  explicit KotkiTranslationModel(string name, string cwd, string pathBundle, Kotki* kotki)
+      : name(name),
+        cwd(cwd),
+        pathBundle_(std::move(pathBundle)),
+        kotki_(kotki) {
+    langFrom = name.substr(0, 2);
+    langTo = name.erase(0, 2);
+  }
+  ~KotkiTranslationModel();
 
   string name;
   string cwd;
   string langFrom;
   string langTo;
-  bool initialized = false;
-  void load();
+  std::atomic<bool> initialized{false};
+  // nonbreaking prefixes of the source language, as embedded in nb_prefix.h
+  const string &nbPrefixes() const;
+  // returns seconds spent in 'load' and, when warming up, in 'warmup' (building each worker's backend)
+  map<string, double> load(bool warmup = false);
+  // load() with warmup, unless already loaded. returns its timings, empty if there was nothing to do
+  map<string, double> preload();
   string translate(string input);
+  // queues input and returns immediately when workers are running; callback is issued from a worker thread,
+  // or from the calling thread on a document cache hit. schedule sets how urgent it is among other translations.
+  void translate(string input, TranslationCallback callback, Schedule schedule = {});
+  // translates input with this model and the result with each of seconds, sentence by sentence: each sentence this
+  // model finishes is queued with the second models right away. callback (optional) receives the result of this model.
+  void translatePivot(string input, TranslationCallback callback,
+                      vector<pair<KotkiTranslationModel*, TranslationCallback>> seconds, Schedule schedule = {});
+  // translates all inputs in one pass through the batching pool, sentences of different inputs share batches
+  vector<string> translate(vector<string> inputs, Schedule schedule = {});
+  // counters for Kotki::cacheStats, empty when not loaded
+  map<string, size_t> stats();
+  // every translation holds the model from acquire() until its callback returned with release(), loading it on
+  // demand. unload() only frees a model nobody holds and returns whether it did.
+  void acquire();
+  bool acquireLoaded();  // acquire() without loading, returns false when not loaded
+  void release();
+  bool unload();
+  // estimated bytes held while loaded, see KotkiConfig::memoryBudget
+  size_t memoryUsage() const { return bytes_; }
+  std::chrono::steady_clock::time_point lastUsed() const {
+    return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(lastUsed_));
+  }
+  void attachCacheSnapshot();
+  size_t saveCacheSnapshot();
+  // writes the snapshot one last time for a model replacing this one, which attaches it next. returns entries written
+  size_t handOverCacheSnapshot();
   shared_ptr<TranslationModel> model;
   map<string, string> toJson() {
     map<string, string> rtn;
     rtn["name"] = this->name;
     rtn["cwd"] = this->cwd;
     rtn["version"] = "";  // @TODO: support versions
+    if(!this->pathBundle_.empty()) {
+      rtn["bundle"] = this->pathBundle_;
+    }
     rtn["model"] = this->pathModel_;
     rtn["lex"] = this->pathLex_;
     if(this->pathVocab_==this->pathTrgVocab_)rtn["vocab"] = this->pathVocab_;
@@ -71,14 +161,38 @@ struct KotkiTranslationModel {
   string pathLex_;
   string pathVocab_;
   string pathTrgVocab_;
+  string pathBundle_;
   Kotki* kotki_;
-  string findNBPrefixFile();
   std::optional<TranslationCache> m_cache = std::nullopt;
+  std::optional<DocumentCache> m_documentCache = std::nullopt;
+  size_t documentKey(const string &input) const;
+  bool findDocument(size_t key, string &result);
+  CallbackType storeDocument(size_t key, TranslationCallback callback);
+  MappedFile cacheSnapshot_;
+  std::atomic<bool> ownsCacheSnapshot_{true};
+  const KotkiCacheConfig &cacheConfig() const;
+  string cacheSnapshotPath() const;
+  std::mutex loadMutex_;
+  std::atomic<size_t> users_{0};
+  std::atomic<size_t> bytes_{0};
+  std::atomic<std::chrono::steady_clock::rep> lastUsed_{0};
+  vector<std::thread> workers_;
+  void work(size_t workerId);
+  // without workers, translations run on the calling thread: draws batches from models until completion is ready.
+  // other callers may batch (some of) its sentences meanwhile, it then waits for them.
+  static void drain(std::future<void> &completion, const vector<KotkiTranslationModel*> &models);
+  // replica 0 of the backend, shared by callers translating on their own thread
+  std::recursive_mutex drainMutex_;
+  void stopWorkers();
+  size_t writeCacheSnapshot();
 };
 
 class Kotki {
  public:
   Kotki();
+  explicit Kotki(const KotkiConfig &config);
+  // waits for translations still running, then stops and frees every model (writing their cache snapshots)
+  ~Kotki();
 
   int scan();
   int scan(const fs::path& path);
@@ -89,17 +203,76 @@ class Kotki {
   vector<KotkiTranslationModel*> loadRegistry(const fs::path &regPath);
 
   string translate(string input, string language);
+  // non-blocking when KotkiConfig::numWorkers > 0, otherwise translation happens before returning.
+  // schedule (priority, deadline) decides which sentences are batched first when several translations are pending.
+  std::future<string> translateAsync(string input, string language, Schedule schedule = {});
+  void translateAsync(string input, string language, TranslationCallback callback, Schedule schedule = {});
+  // scheduled as Priority::bulk, sentences of more urgent translations are batched first
+  vector<string> translateMany(vector<string> inputs, string language);
+  // translates input from language 'from' into each of 'to', e.g. ("nl", {"en", "de", "fr"}). hops shared by several
+  // targets (here 'nlen') are translated once. returns the translation per target, empty if it has no route.
+  map<string, string> translateToMany(string input, string from, vector<string> to);
   map<string, map<string, string>> listModels();
-  void ensureConfigDirectory();
-  void ensureNBPrefixes() const;
+  // per loaded model: duplicates (sentences repeated within one input, translated once), batches and their
+  // batch_sentences/batch_tokens/batch_padded_tokens, and, with caching enabled, hits/misses/evictions/rejected of the
+  // translation cache.
+  // with KotkiCacheConfig::documentSize set, the same counters of the document cache are prefixed with 'document_'.
+  map<string, map<string, size_t>> cacheStats();
+  // loads the models of names (pairs, e.g. 'nlen', or 'bgde' for every model of its route), all models when empty,
+  // in parallel. each model builds and warms up its backends, so the first translation does not wait for it.
+  // returns per model the seconds spent, see KotkiTranslationModel::load. models loaded before are left out.
+  map<string, map<string, double>> preload(vector<string> names = {});
+  // estimated bytes per loaded model, see KotkiConfig::memoryBudget
+  map<string, size_t> memoryUsage();
+  // unload least recently used idle models until the loaded ones fit KotkiConfig::memoryBudget
+  void enforceMemoryBudget();
+  // write the translation caches to KotkiCacheConfig::snapshotDir, returns number of entries written
+  size_t saveCaches();
+  // creates kotkiCfgModelDir (and kotkiCfgDir), returns false if that failed. not needed for scan()
+  bool ensureConfigDirectory();
   static string find_config_directory();
 
   std::filesystem::path kotkiCfgDir;
-  std::filesystem::path kotkiCfgNbDir;
   std::filesystem::path kotkiCfgModelDir;
+  const KotkiConfig config;
 
  private:
-  map<string, KotkiTranslationModel*> m_models;
+  struct Models {
+    map<string, KotkiTranslationModel*> models;
+    // models to chain per language pair, e.g. 'bgde' -> {bgen, ende}, or a single model for a direct pair.
+    // planned by scan() over all loaded models.
+    unordered_map<string, vector<KotkiTranslationModel*>> routes;
+    // the snapshot published after this one. an older snapshot may share models with every later one, holding on to
+    // them keeps their retiring models alive until it is released as well. set by publish()
+    mutable shared_ptr<const Models> next;
+  };
+  // the models as published by scan(). translations hold on to the snapshot they started with; a rescan publishes a
+  // new one, and the models it replaced are freed once the previous snapshot and all earlier ones are released, after
+  // the last translation that could still be using them.
+  shared_ptr<const Models> m_snapshot;
+  // models to free once m_snapshot is released, filled when it is replaced. guarded by m_residencyMutex
+  shared_ptr<vector<KotkiTranslationModel*>> m_retiring;
+  shared_ptr<const Models> snapshot() const { return std::atomic_load(&m_snapshot); }
+  void publish(Models models);
+  // called as a snapshot is released, hands its retiring models over to m_reaper for deleting: the last holder may be
+  // a callback on a worker of one of them, which can't join itself
+  void released(vector<KotkiTranslationModel*> retiring);
+  static void planRoutes(Models &models);
+  using RouteCallback = pair<vector<KotkiTranslationModel*>, TranslationCallback>;
+  void translateRoutes(string input, vector<RouteCallback> routes, Schedule schedule);
+  static string stripLeadingDash(string result);
+  // one scan() or round of unloading at a time
+  std::mutex m_residencyMutex;
+  // deletes retired models, and unloads models idle for KotkiConfig::idleTimeout
+  std::thread m_reaper;
+  std::mutex m_retiredMutex;
+  std::condition_variable m_reaperWake;
+  vector<KotkiTranslationModel*> m_retired;
+  // published snapshots not yet released, ~Kotki waits for all of them
+  size_t m_liveSnapshots = 0;
+  bool m_stopping = false;
+  void reap();
+  void unloadIdle();
 };
 
 #endif // KroketTranslation_H
\ No newline at end of file
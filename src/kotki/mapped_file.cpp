@@ -0,0 +1,54 @@
+#include "kotki/mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace marian {
+namespace bergamot {
+
+MappedFile::MappedFile(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+
+  struct stat info {};
+  if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+    void *data = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      data_ = data;
+      size_ = info.st_size;
+    }
+  }
+
+  // The mapping stays valid after closing the descriptor.
+  ::close(fd);
+}
+
+MappedFile::MappedFile(MappedFile &&from) noexcept : data_(from.data_), size_(from.size_) {
+  from.data_ = nullptr;
+  from.size_ = 0;
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&from) noexcept {
+  if (this == &from) return *this;
+  release();
+  data_ = from.data_;
+  size_ = from.size_;
+  from.data_ = nullptr;
+  from.size_ = 0;
+  return *this;
+}
+
+void MappedFile::release() {
+  if (data_ != nullptr) {
+    ::munmap(data_, size_);
+    data_ = nullptr;
+    size_ = 0;
+  }
+}
+
+}  // namespace bergamot
+}  // namespace marian
@@ -0,0 +1,48 @@
+#ifndef SRC_BERGAMOT_MAPPED_FILE_H_
+#define SRC_BERGAMOT_MAPPED_FILE_H_
+
+#include <cstddef>
+#include <string>
+
+namespace marian {
+namespace bergamot {
+
+/// Read-only memory map of a whole file. Pages are shared with the page-cache (and other processes mapping the same
+/// file) and are only read from disk when touched.
+///
+/// The mapping shows the file as it is on disk, not as it was when mapped: a file rewritten in place (`cp` over it, a
+/// package upgrade truncating it) changes or, when truncated, faults (SIGBUS) under whoever is reading it. Files that
+/// may be mapped are therefore to be replaced by writing a new file and renaming it over the old one; the mapping then
+/// keeps the old inode alive.
+class MappedFile {
+ public:
+  MappedFile() = default;
+
+  /// Maps the file at path. Check valid() afterwards, a missing or unreadable file gives an empty mapping.
+  explicit MappedFile(const std::string &path);
+
+  MappedFile(MappedFile &&from) noexcept;
+  MappedFile &operator=(MappedFile &&from) noexcept;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile() { release(); }
+
+  bool valid() const { return data_ != nullptr; }
+  const char *begin() const { return static_cast<const char *>(data_); }
+  /// For interfaces taking mutable memory (AlignedMemory). The pages are read-only, writing through it faults.
+  char *data() const { return static_cast<char *>(data_); }
+  const char *end() const { return begin() + size_; }
+  size_t size() const { return size_; }
+
+ private:
+  void *data_{nullptr};
+  size_t size_{0};
+
+  void release();
+};
+
+}  // namespace bergamot
+}  // namespace marian
+
+#endif  // SRC_BERGAMOT_MAPPED_FILE_H_
@@ -0,0 +1,148 @@
+#include "kotki/model_bundle.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+#include "kotki/mapped_file.h"
+#include "marian-lite/common/logging.h"
+
+namespace marian {
+namespace bergamot {
+
+namespace {
+
+const uint64_t BUNDLE_MAGIC = 0x4C444E42494B544BULL;  // "KTKIBNDL"
+const uint64_t BUNDLE_VERSION = 1;
+const size_t BUNDLE_ALIGNMENT = 256;
+
+struct BundleHeader {
+  uint64_t magic;
+  uint64_t version;
+  uint64_t numSections;
+};
+
+struct BundleSectionEntry {
+  uint32_t type;
+  uint32_t padding;
+  uint64_t offset;
+  uint64_t size;
+};
+
+size_t alignUp(size_t offset) { return (offset + BUNDLE_ALIGNMENT - 1) / BUNDLE_ALIGNMENT * BUNDLE_ALIGNMENT; }
+
+// Sets each 'key: value' line of text on options.
+void applyOptions(std::string_view text, Ptr<Options> options) {
+  std::istringstream lines{std::string(text)};
+  std::string line;
+  while (std::getline(lines, line)) {
+    size_t colon = line.find(':');
+    if (line.empty() || line[0] == '#' || colon == std::string::npos) {
+      continue;
+    }
+    size_t valueBegin = line.find_first_not_of(' ', colon + 1);
+    std::string value = valueBegin == std::string::npos ? "" : line.substr(valueBegin);
+    options->set(line.substr(0, colon), value);
+  }
+}
+
+}  // namespace
+
+size_t writeModelBundle(const std::vector<std::pair<BundleSection, std::string_view>> &sections,
+                        const std::string &path) {
+  std::vector<BundleSectionEntry> entries;
+  size_t offset = sizeof(BundleHeader) + sections.size() * sizeof(BundleSectionEntry);
+  for (auto &[type, data] : sections) {
+    for (auto &entry : entries) {
+      ABORT_IF(entry.type == static_cast<uint32_t>(type), "Section {} appears twice in bundle {}",
+               static_cast<uint32_t>(type), path);
+    }
+    offset = alignUp(offset);
+    entries.push_back(BundleSectionEntry{static_cast<uint32_t>(type), 0, offset, data.size()});
+    offset += data.size();
+  }
+
+  BundleHeader header{BUNDLE_MAGIC, BUNDLE_VERSION, entries.size()};
+
+  // Write next to the destination and rename, so loaders never map a half-written bundle.
+  std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    ABORT_IF(!out, "Failed opening bundle {} for writing", tmpPath);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(BundleSectionEntry));
+
+    const std::string zeros(BUNDLE_ALIGNMENT, '\0');
+    size_t written = sizeof(BundleHeader) + entries.size() * sizeof(BundleSectionEntry);
+    for (size_t i = 0; i < sections.size(); i++) {
+      out.write(zeros.data(), entries[i].offset - written);
+      out.write(sections[i].second.data(), sections[i].second.size());
+      written = entries[i].offset + entries[i].size;
+    }
+    ABORT_IF(!out, "Failed writing bundle {}", tmpPath);
+  }
+  ABORT_IF(std::rename(tmpPath.c_str(), path.c_str()) != 0, "Failed moving bundle into place at {}", path);
+  return offset;
+}
+
+MemoryBundle loadModelBundle(const std::string &path, Ptr<Options> options) {
+  auto mapping = std::make_shared<MappedFile>(path);
+  ABORT_IF(!mapping->valid() || mapping->size() < sizeof(BundleHeader), "Failed mapping bundle {}", path);
+
+  BundleHeader header;
+  std::memcpy(&header, mapping->begin(), sizeof(header));
+  ABORT_IF(header.magic != BUNDLE_MAGIC, "{} is not a model bundle", path);
+  ABORT_IF(header.version != BUNDLE_VERSION, "Unsupported version {} of bundle {}", header.version, path);
+  ABORT_IF(header.numSections > (mapping->size() - sizeof(BundleHeader)) / sizeof(BundleSectionEntry),
+           "Truncated bundle {}", path);
+
+  MemoryBundle memory;
+  std::shared_ptr<AlignedMemory> sourceVocab, targetVocab;
+  const auto *entries = reinterpret_cast<const BundleSectionEntry *>(mapping->begin() + sizeof(BundleHeader));
+  for (size_t i = 0; i < header.numSections; i++) {
+    const BundleSectionEntry &entry = entries[i];
+    ABORT_IF(entry.offset > mapping->size() || entry.size > mapping->size() - entry.offset,
+             "Truncated bundle {}", path);
+    ABORT_IF(entry.offset % BUNDLE_ALIGNMENT != 0, "Misaligned section {} in bundle {}", entry.type, path);
+
+    char *data = mapping->data() + entry.offset;
+    AlignedMemory section(data, entry.size, mapping);
+    switch (static_cast<BundleSection>(entry.type)) {
+      case BundleSection::model:
+        memory.model = std::move(section);
+        break;
+      case BundleSection::shortlist:
+        memory.shortlist = std::move(section);
+        break;
+      case BundleSection::sourceVocab:
+        sourceVocab = std::make_shared<AlignedMemory>(std::move(section));
+        break;
+      case BundleSection::targetVocab:
+        targetVocab = std::make_shared<AlignedMemory>(std::move(section));
+        break;
+      case BundleSection::ssplitPrefixes:
+        memory.ssplitPrefixFile = std::move(section);
+        break;
+      case BundleSection::qualityEstimator:
+        memory.qualityEstimatorMemory = std::move(section);
+        break;
+      case BundleSection::options:
+        applyOptions(std::string_view(data, entry.size), options);
+        break;
+      default:
+        // Sections added by later versions of the writer are skipped.
+        break;
+    }
+  }
+
+  ABORT_IF(memory.model.size() == 0, "Bundle {} has no model", path);
+  ABORT_IF(!sourceVocab, "Bundle {} has no vocabulary", path);
+  // Vocabs shares the loaded vocabulary between both sides when they are the same object.
+  memory.vocabs = {sourceVocab, targetVocab ? targetVocab : sourceVocab};
+  return memory;
+}
+
+}  // namespace bergamot
+}  // namespace marian
@@ -0,0 +1,49 @@
+#ifndef SRC_BERGAMOT_MODEL_BUNDLE_H_
+#define SRC_BERGAMOT_MODEL_BUNDLE_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "marian-lite/common/options.h"
+#include "kotki/definitions.h"
+
+namespace marian {
+namespace bergamot {
+
+/// A model bundle packs all files a TranslationModel needs into one, so that a MemoryBundle is filled from a single
+/// memory map instead of opening and reading 4 to 6 files. Layout (native endianness, offsets in bytes from the start
+/// of the file):
+///
+/// ```
+///   BundleHeader                      magic, version, number of sections
+///   BundleSectionEntry[numSections]   type, offset and size of each section
+///   section data                      each section starts at a multiple of 256 bytes, as the model requires
+/// ```
+///
+/// A section type appears at most once. Without a targetVocab section, the source vocabulary is shared.
+enum class BundleSection : uint32_t {
+  model = 1,             ///< binary (.bin) model
+  shortlist = 2,         ///< binary shortlist
+  sourceVocab = 3,       ///< SentencePiece vocabulary (.spm)
+  targetVocab = 4,       ///< SentencePiece vocabulary (.spm), if it differs from the source one
+  ssplitPrefixes = 5,    ///< nonbreaking prefixes for the sentence splitter, in the moses file format
+  qualityEstimator = 6,  ///< quality estimator model
+  options = 7,           ///< marian options to load the model with, one 'key: value' per line
+};
+
+/// Writes sections into a bundle at path, replacing an existing file atomically.
+/// @returns size of the bundle in bytes.
+size_t writeModelBundle(const std::vector<std::pair<BundleSection, std::string_view>> &sections,
+                        const std::string &path);
+
+/// Maps the bundle at path (read-only, see MappedFile on replacing it) and fills a MemoryBundle with views of its
+/// sections, which keep the mapping alive. The options section, if present, is applied to options.
+MemoryBundle loadModelBundle(const std::string &path, Ptr<Options> options);
+
+}  // namespace bergamot
+}  // namespace marian
+
+#endif  // SRC_BERGAMOT_MODEL_BUNDLE_H_
@@ -1,5 +1,7 @@
 #include "request.h"
 
+#include <cassert>
+#include <numeric>
 #include <string>
 
 #include "kotki/annotation.h"
@@ -13,7 +15,7 @@ namespace marian {
 namespace bergamot {
 
 size_t hashForCache(const TranslationModel &model, const marian::Words &words) {
-  size_t seed = model.modelId();
+  size_t seed = model.cacheNamespace();
   for (auto &word : words) {
     size_t hashWord = static_cast<size_t>(word.toWordIndex());
     util::hash_combine<size_t>(seed, hashWord);
@@ -22,46 +24,127 @@ size_t hashForCache(const TranslationModel &model, const marian::Words &words) {
 }
 
 // -----------------------------------------------------------------
+std::atomic<size_t> Request::requestCounter_ = 0;
+
 Request::Request(const TranslationModel &model, Segments &&segments, ResponseBuilder &&responseBuilder,
-                 std::optional<TranslationCache> &cache)
-    : model_(model),
+                 std::optional<TranslationCache> &cache, InFlightSentences &inFlight, CallbackType callback,
+                 SentenceCallback onSentence, Schedule schedule)
+    : Id_(requestCounter_++),
+      schedule_(schedule),
+      model_(model),
       segments_(std::move(segments)),
       responseBuilder_(std::move(responseBuilder)),
-      cache_(cache) {
+      cache_(cache),
+      inFlight_(inFlight),
+      callback_(std::move(callback)),
+      onSentence_(std::move(onSentence)) {
   counter_ = segments_.size();
-  histories_.resize(segments_.size(), nullptr);
+  translations_.resize(segments_.size(), nullptr);
 
   // 1. If there are no segments_, we are never able to trigger the responseBuilder calls from a different thread. This
   // happens when the use provides empty input, or the sentence and subword preprocessing deems no translatable units
   // present. However, in this case we want an empty valid response. There's no need to do any additional processing
   // here.
   if (segments_.size() == 0) {
-    response = responseBuilder_.build(std::move(histories_));
+    complete();
   } else {
     counter_ = segments_.size();
-    histories_.resize(segments_.size());
+    translations_.resize(segments_.size());
+
+    keys_.reserve(segments_.size());
+    for (size_t idx = 0; idx < segments_.size(); idx++) {
+      keys_.push_back(hashForCache(model_, getSegment(idx)));
+    }
+
+    // Segments repeating an earlier segment of this request are neither looked up nor translated, they take the
+    // translation of the first occurrence when the Response is built.
+    original_.resize(segments_.size());
+    std::iota(original_.begin(), original_.end(), 0);
+    nextDuplicate_.resize(segments_.size(), npos);
+    std::unordered_map<size_t, size_t> lastOccurrence;
+    lastOccurrence.reserve(segments_.size());
+    for (size_t idx = 0; idx < segments_.size(); idx++) {
+      auto [last, inserted] = lastOccurrence.emplace(keys_[idx], idx);
+      if (!inserted) {
+        original_[idx] = original_[last->second];
+        nextDuplicate_[last->second] = idx;
+        last->second = idx;
+        ++duplicates_;
+        --counter_;
+      }
+    }
+#ifndef NDEBUG
+    // counter_ must count exactly the segments which get looked up or translated, or the Request never completes.
+    size_t originals = 0;
+    for (size_t idx = 0; idx < segments_.size(); idx++) {
+      assert(keys_[original_[idx]] == keys_[idx] && original_[idx] <= idx);
+      originals += isDuplicate(idx) ? 0 : 1;
+    }
+    assert(originals == counter_);
+#endif
 
     if (cache_) {
       // Iterate through segments, see if any can be prefilled from cache. If prefilled, mark the particular segments as
       // complete (non-empty ProcessedRequestSentence). Also update accounting used elsewhere (counter_) to reflect one
       // less segment to translate.
       for (size_t idx = 0; idx < segments_.size(); idx++) {
-        size_t key = hashForCache(model_, getSegment(idx));
-        auto [found, history] = cache_->find(key);
+        if (isDuplicate(idx)) {
+          continue;
+        }
+        auto [found, translation] = cache_->find(keys_[idx]);
         if (found) {
-          histories_[idx] = history;
+          resolve(idx, translation);
           --counter_;
         }
       }
-      // 2. Also, if cache somehow manages to decrease all counter prefilling histories, then we'd have to trigger
+      // 2. Also, if cache somehow manages to decrease all counter prefilling translations, then we'd have to trigger
       // ResponseBuilder as well. No segments go into batching and therefore no processHistory triggers.
       if (counter_.load() == 0) {
-        response = responseBuilder_.build(std::move(histories_));
+        complete();
       }
     }
   }
 }
 
+Request::Request(const TranslationModel &model, size_t numSegments, ResponseBuilder &&responseBuilder,
+                 std::optional<TranslationCache> &cache, InFlightSentences &inFlight, CallbackType callback,
+                 Schedule schedule)
+    : Id_(requestCounter_++),
+      schedule_(schedule),
+      model_(model),
+      segments_(numSegments),
+      responseBuilder_(std::move(responseBuilder)),
+      cache_(cache),
+      inFlight_(inFlight),
+      callback_(std::move(callback)) {
+  counter_ = numSegments;
+  keys_.resize(numSegments);
+  translations_.resize(numSegments, nullptr);
+
+  // Segments arrive one by one, so duplicates are not known upfront. Identical ones still share their translation
+  // through inFlight_.
+  original_.resize(numSegments);
+  std::iota(original_.begin(), original_.end(), 0);
+  nextDuplicate_.resize(numSegments, npos);
+
+  if (numSegments == 0) {
+    complete();
+  }
+}
+
+bool Request::provideSegment(size_t index, Segment &&segment) {
+  segments_[index] = std::move(segment);
+  keys_[index] = hashForCache(model_, segments_[index]);
+  if (cache_) {
+    auto [found, translation] = cache_->find(keys_[index]);
+    if (found) {
+      processTranslation(index, translation);
+      return false;
+    }
+  }
+  return true;
+}
+
 size_t Request::numSegments() const { return segments_.size(); }
 
 size_t Request::segmentTokens(size_t index) const { return (segments_[index].size()); }
@@ -70,26 +153,61 @@ Segment Request::getSegment(size_t index) const { return segments_[index]; }
 
 void Request::processHistory(size_t index, Ptr<History> history) {
   // Concurrently called by multiple workers as a history from translation is
-  // ready. The container storing histories is set with the value obtained.
+  // ready. The decoded translation is set with the value obtained.
 
-  // Fill in placeholder from History obtained by freshly translating. Since this was a cache-miss to have got through,
-  // update cache if available to store the result.
-  histories_[index] = history;
+  // Fill in placeholder from History obtained by freshly translating, decoded right away so that only the text is kept
+  // around. Since this was a cache-miss to have got through, update cache if available to store the result.
+  Ptr<const TranslatedSentence> translation = responseBuilder_.decode(*history);
+  resolve(index, translation);
   if (cache_) {
-    size_t key = hashForCache(model_, getSegment(index));
-    cache_->store(key, histories_[index]);
+    cache_->store(keys_[index], translation);
+  }
+
+  // Identical sentences which arrived while this one was in flight get the same translation. Released after storing
+  // into the cache, so that later arrivals find it there.
+  for (auto &sentence : inFlight_.release(inFlightKey(index))) {
+    sentence.completeSentence(translation);
   }
 
   // In case this is last request in, completeRequest is called, which sets the
   // value of the promise.
   if (--counter_ == 0) {
-    response = responseBuilder_.build(std::move(histories_));
+    complete();
+  }
+}
+
+void Request::processTranslation(size_t index, Ptr<const TranslatedSentence> translation) {
+  resolve(index, translation);
+  if (--counter_ == 0) {
+    complete();
+  }
+}
+
+void Request::resolve(size_t index, const Ptr<const TranslatedSentence> &translation) {
+  translations_[index] = translation;
+  if (onSentence_) {
+    for (size_t idx = index; idx != npos; idx = nextDuplicate_[idx]) {
+      onSentence_(idx, *translation);
+    }
+  }
+}
+
+void Request::complete() {
+  if (duplicates_ > 0) {
+    for (size_t idx = 0; idx < translations_.size(); idx++) {
+      translations_[idx] = translations_[original_[idx]];
+    }
+  }
+  response = responseBuilder_.build(std::move(translations_));
+  response.duplicateSentences = duplicates_;
+  if (callback_) {
+    callback_(std::move(response));
   }
 }
 
 // ------------------------------------------------------------------
 
-RequestSentence::RequestSentence(size_t index, Ptr<Request> request) : index_(index), request_(request) {}
+RequestSentence::RequestSentence(size_t index, Ptr<Request> request) : index_(index), request_(std::move(request)) {}
 
 size_t RequestSentence::numTokens() const { return (request_->segmentTokens(index_)); }
 
@@ -99,14 +217,36 @@ void RequestSentence::completeSentence(Ptr<History> history) {
   request_->processHistory(index_, history);
 }
 
+void RequestSentence::completeSentence(Ptr<const TranslatedSentence> translation) {
+  request_->processTranslation(index_, translation);
+}
+
+bool RequestSentence::acquire() const {
+  return request_->inFlightSentences().acquire(request_->inFlightKey(index_), *this);
+}
+
 Segment RequestSentence::getUnderlyingSegment() const { return request_->getSegment(index_); }
 
-bool operator<(const RequestSentence &a, const RequestSentence &b) {
-  // Operator overload for usage in priority-queue / set.
-  if (a.request_ == b.request_) {
-    return a.index_ < b.index_;
+// ----------------------------------------------------------------------
+
+bool InFlightSentences::acquire(size_t key, const RequestSentence &sentence) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto [waiting, first] = waiting_.try_emplace(key);
+  if (!first) {
+    waiting->second.push_back(sentence);
+  }
+  return first;
+}
+
+RequestSentences InFlightSentences::release(size_t key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  RequestSentences waiting;
+  auto entry = waiting_.find(key);
+  if (entry != waiting_.end()) {
+    waiting = std::move(entry->second);
+    waiting_.erase(entry);
   }
-  return a.request_ < b.request_;
+  return waiting;
 }
 
 // ----------------------------------------------------------------------
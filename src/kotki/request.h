@@ -2,7 +2,10 @@
 #define SRC_BERGAMOT_REQUEST_H_
 
 #include <cassert>
+#include <chrono>
 #include <future>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
 #include "kotki/annotation.h"
@@ -18,6 +21,24 @@ namespace marian {
 namespace bergamot {
 
 class TranslationModel;
+class InFlightSentences;
+
+/// Scheduling class of a Request. BatchingPool batches the sentences of lower classes first.
+enum class Priority : uint8_t {
+  interactive = 0,  ///< someone is waiting on it, e.g. a user interface
+  normal = 1,
+  bulk = 2,  ///< documents and background jobs, served when nothing more urgent is pending
+};
+
+/// How urgent a Request is. Sentences are batched by priority, then by earliest deadline, then in the order their
+/// requests arrived.
+struct Schedule {
+  Priority priority{Priority::normal};
+  std::chrono::steady_clock::time_point deadline{std::chrono::steady_clock::time_point::max()};
+};
+
+/// Issued with each sentence of a Request as soon as its translation is known, see Request::Request(...).
+using SentenceCallback = std::function<void(size_t index, const TranslatedSentence &translation)>;
 
 /// A Request is an internal representation used to represent a request after
 /// processed by TextProcessor into sentences constituted by marian::Words.
@@ -34,9 +55,12 @@ class TranslationModel;
 /// ```
 ///
 /// When all sentences in a Request are completed, responseBuilder is
-/// triggered with the compiled Histories, to construct the Response
+/// triggered with the compiled translations, to construct the Response
 /// corresponding to the Request and set value of the promise which triggers the
 /// future at client.
+///
+/// A sentence identical to one already queued or being translated (see InFlightSentences) is not batched again. It
+/// completes through RequestSentence::completeSentence(translation) once the first one is done.
 class Request {
  public:
   /// Constructs an internal representation of the Request identified by Id,
@@ -52,8 +76,26 @@ class Request {
   /// Request.
   /// @param [in] cache: Cache supplied externally to attempt to fetch translations or store them after completion for
   /// reuse later.
+  /// @param [in] inFlight: Sentences of model currently queued or being translated, shared by all its requests.
+  /// @param [in] callback: Optional callback to be issued with the Response once all segments are translated. If
+  /// supplied, the Response is moved into the callback, otherwise it stays available in `response`.
+  /// @param [in] onSentence: Optional callback issued for every segment as soon as its translation is known, before
+  /// the Request as a whole completes. Used to pipeline the sentences of a pivot translation into the second model.
+  /// @param [in] schedule: Priority and deadline the sentences of this Request are batched with.
   Request(const TranslationModel &model, Segments &&segments, ResponseBuilder &&responseBuilder,
-          std::optional<TranslationCache> &cache);
+          std::optional<TranslationCache> &cache, InFlightSentences &inFlight, CallbackType callback = nullptr,
+          SentenceCallback onSentence = nullptr, Schedule schedule = {});
+
+  /// Constructs a Request of numSegments segments which are not known yet, each is supplied later through
+  /// provideSegment(...). This is the second hop of a pivot translation, which starts on a sentence as soon as the
+  /// first hop finished it. For the other parameters, see the constructor above.
+  Request(const TranslationModel &model, size_t numSegments, ResponseBuilder &&responseBuilder,
+          std::optional<TranslationCache> &cache, InFlightSentences &inFlight, CallbackType callback,
+          Schedule schedule = {});
+
+  /// Supplies the segment corresponding to index of a Request constructed without segments.
+  /// @returns true if the segment needs translating, false if it was served from the cache.
+  bool provideSegment(size_t index, Segment &&segment);
 
   Response response;
 
@@ -68,23 +110,49 @@ class Request {
   /// among several requests.
   Segment getSegment(size_t index) const;
 
-  /// For notions of priority among requests, used to enable std::set in
-  /// BatchingPool.
-  bool operator<(const Request &request) const;
+  /// Key of the segment corresponding to index, identifies identical sentences across requests (see hashForCache).
+  size_t segmentKey(size_t index) const { return keys_[index]; }
+
+  /// Key of the segment corresponding to index in InFlightSentences. Sentences only wait on identical ones of the same
+  /// Priority: a sentence in flight for a bulk request would otherwise hold up an interactive one behind all pending
+  /// interactive and normal sentences.
+  size_t inFlightKey(size_t index) const {
+    return keys_[index] ^ (static_cast<size_t>(schedule_.priority) * 0x9E3779B97F4A7C15ULL);
+  }
+
+  InFlightSentences &inFlightSentences() const { return inFlight_; }
+
+  const Schedule &schedule() const { return schedule_; }
+
+  /// Sequence number of the Request, in order of construction.
+  size_t id() const { return Id_; }
 
   /// Processes a history obtained after translating in a heterogenous batch
   /// compiled from requests.
   void processHistory(size_t index, Ptr<History> history);
 
-  bool cacheHitPrefilled(size_t index) const { return histories_[index] != nullptr; }
+  /// Processes a translation obtained for an identical sentence translated on behalf of this one.
+  void processTranslation(size_t index, Ptr<const TranslatedSentence> translation);
+
+  bool cacheHitPrefilled(size_t index) const { return translations_[index] != nullptr; }
+
+  /// Whether the segment corresponding to index repeats an earlier segment of this request, and thus needs no
+  /// translation of its own.
+  bool isDuplicate(size_t index) const { return original_[index] != index; }
+
+  /// Number of segments which repeat an earlier segment of this request.
+  size_t duplicateSentences() const { return duplicates_; }
 
   /// Constructing Response requires the vocabs_ used to generate Request.
   /// std::vector<Ptr<Vocab const>> *vocabs_;
   ResponseBuilder responseBuilder_;
 
  private:
+  static std::atomic<size_t> requestCounter_;
   size_t Id_;
 
+  Schedule schedule_;
+
   /// TranslationModel associated with this request
   const TranslationModel &model_;
 
@@ -97,12 +165,36 @@ class Request {
   /// input string.
   Segments segments_;
 
-  /// histories_ is a buffer which eventually stores the translations of each
-  /// segment in the corresponding index.
-  std::vector<Ptr<History>> histories_;
+  /// keys_ holds hashForCache of each segment in the corresponding index.
+  std::vector<size_t> keys_;
+
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  /// original_ holds the index of the first segment with the same key, which is the index itself unless the segment is
+  /// a duplicate. nextDuplicate_ links each segment to the next one with the same key, npos for the last.
+  std::vector<size_t> original_;
+  std::vector<size_t> nextDuplicate_;
+  size_t duplicates_{0};
+
+  /// translations_ is a buffer which eventually stores the decoded translations
+  /// of each segment in the corresponding index.
+  std::vector<Ptr<const TranslatedSentence>> translations_;
 
   /// Cache used to hold unit translations. If nullopt, means no-caching.
   std::optional<TranslationCache> &cache_;
+
+  InFlightSentences &inFlight_;
+
+  /// Issued by whichever thread completes the last segment.
+  CallbackType callback_;
+
+  SentenceCallback onSentence_;
+
+  /// Sets the translation of the segment corresponding to index and issues onSentence_ for it and its duplicates.
+  void resolve(size_t index, const Ptr<const TranslatedSentence> &translation);
+
+  /// Builds the Response from translations_ and hands it to callback_ if one was supplied.
+  void complete();
 };
 
 /// A RequestSentence provides a view to a sentence within a Request. Existence
@@ -117,6 +209,14 @@ class RequestSentence {
   /// order by length in batching.
   size_t numTokens() const;
 
+  /// Schedule of the Request this sentence belongs to.
+  const Schedule &schedule() const { return request_->schedule(); }
+
+  /// Index of the segment in its Request.
+  size_t index() const { return index_; }
+
+  const Ptr<Request> &request() const { return request_; }
+
   /// Accessor to the segment represented by the RequestSentence.
   Segment getUnderlyingSegment() const;
 
@@ -124,7 +224,13 @@ class RequestSentence {
   /// RequestSentence.
   void completeSentence(Ptr<History> history);
 
-  friend bool operator<(const RequestSentence &a, const RequestSentence &b);
+  /// Forwards the translation of an identical sentence to Request.
+  void completeSentence(Ptr<const TranslatedSentence> translation);
+
+  /// Registers this sentence as queued for translation.
+  /// @returns false if an identical sentence already is, this one then completes along with it and is not to be
+  /// batched.
+  bool acquire() const;
 
  private:
   size_t index_;
@@ -133,6 +239,23 @@ class RequestSentence {
 
 typedef std::vector<RequestSentence> RequestSentences;
 
+/// Single-flight bookkeeping of the sentences of a TranslationModel that are queued or being translated, by
+/// Request::inFlightKey. When identical sentences arrive meanwhile (a page header fanned out to many users, a repeated
+/// line), only the first is batched, the others wait here and receive its translation.
+class InFlightSentences {
+ public:
+  /// @returns true if no sentence with key is in flight, marking key as in flight. Otherwise sentence waits on the
+  /// one in flight and false is returned.
+  bool acquire(size_t key, const RequestSentence &sentence);
+
+  /// Marks key as done. @returns the sentences that waited on it, to be completed by the caller.
+  RequestSentences release(size_t key);
+
+ private:
+  std::mutex mutex_;
+  std::unordered_map<size_t, RequestSentences> waiting_;
+};
+
 }  // namespace bergamot
 }  // namespace marian
 
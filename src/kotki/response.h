@@ -60,6 +60,10 @@ struct Response {
   /// with an alignment matrix for each sentence.
   std::vector<std::vector<std::vector<float>>> alignments;
 
+  /// Number of sentences which repeat an earlier sentence of the source text. These are translated once, the repeats
+  /// reuse that translation.
+  size_t duplicateSentences = 0;
+
   /// Returns the source sentence (in terms of byte range) corresponding to sentenceIdx.
   ///
   /// @param [in] sentenceIdx: The index representing the sentence where 0 <= sentenceIdx < Response::size()
@@ -21,33 +21,57 @@ void ResponseBuilder::buildAlignments(Histories &histories, Response &response)
   }
 }
 
-void ResponseBuilder::buildTranslatedText(Histories &histories, Response &response) {
+Ptr<const TranslatedSentence> ResponseBuilder::decode(const History &history) const {
+  // TODO(jerin): Change hardcode of nBest = 1
+  NBestList onebest = history.nBest(1);
+
+  Result result = onebest[0];  // Expecting only one result;
+  Words words = std::get<0>(result);
+
+  std::string decoded;
+  std::vector<string_view> targetSentenceMappings;
+  vocabs_.target()->decodeWithByteRanges(words, decoded, targetSentenceMappings, /*ignoreEOS=*/false);
+
+  // Tokens are contiguous, keep only the text they cover and their boundaries relative to it.
+  auto translation = New<TranslatedSentence>();
+  if (!targetSentenceMappings.empty()) {
+    const char *begin = targetSentenceMappings.front().data();
+    const char *end = targetSentenceMappings.back().data() + targetSentenceMappings.back().size();
+    translation->text.assign(begin, end);
+    translation->tokenOffsets.reserve(targetSentenceMappings.size() + 1);
+    for (auto &token : targetSentenceMappings) {
+      translation->tokenOffsets.push_back(static_cast<uint32_t>(token.data() - begin));
+    }
+    translation->tokenOffsets.push_back(static_cast<uint32_t>(end - begin));
+  }
+  return translation;
+}
+
+void ResponseBuilder::buildTranslatedText(std::vector<Ptr<const TranslatedSentence>> &translations,
+                                          Response &response) {
   // Reserving length at least as much as source_ seems like a reasonable
   // thing to do to avoid reallocations.
   response.target.text.reserve(response.source.text.size());
 
-  for (size_t sentenceIdx = 0; sentenceIdx < histories.size(); sentenceIdx++) {
-    // TODO(jerin): Change hardcode of nBest = 1
-
-    auto &history = histories[sentenceIdx];
-    NBestList onebest = history->nBest(1);
+  std::vector<string_view> targetSentenceMappings;
+  for (size_t sentenceIdx = 0; sentenceIdx < translations.size(); sentenceIdx++) {
+    const TranslatedSentence &translation = *translations[sentenceIdx];
 
-    Result result = onebest[0];  // Expecting only one result;
-    Words words = std::get<0>(result);
-
-    std::string decoded;
-    std::vector<string_view> targetSentenceMappings;
-    vocabs_.target()->decodeWithByteRanges(words, decoded, targetSentenceMappings, /*ignoreEOS=*/false);
+    targetSentenceMappings.clear();
+    for (size_t token = 0; token < translation.numTokens(); token++) {
+      size_t begin = translation.tokenOffsets[token];
+      size_t end = translation.tokenOffsets[token + 1];
+      targetSentenceMappings.emplace_back(translation.text.data() + begin, end - begin);
+    }
 
     // For each sentence, prepend the filler text between the corresponding
     // source-sentence and the source-sentence before.
     string_view pre = response.source.gap(sentenceIdx);
     response.target.appendSentence(pre, targetSentenceMappings.begin(), targetSentenceMappings.end());
 
-    // If this is the last history to be decoded and translated-text
-    // constructed, append the text till the end, which could be spaces or
-    // empty.
-    if (sentenceIdx + 1 == histories.size()) {
+    // If this is the last sentence to be translated-text constructed, append
+    // the text till the end, which could be spaces or empty.
+    if (sentenceIdx + 1 == translations.size()) {
       response.target.appendEndingWhitespace(response.source.gap(sentenceIdx + 1));
     }
   }
@@ -33,18 +33,23 @@ class ResponseBuilder {
         vocabs_(vocabs),
         qualityEstimator_(qualityEstimator) {}
 
-  Response build(Histories &&histories) {
-    ABORT_IF(source_.numSentences() != histories.size(), "Mismatch in source and translated sentences");
+  Response build(std::vector<Ptr<const TranslatedSentence>> &&translations) {
+    ABORT_IF(source_.numSentences() != translations.size(), "Mismatch in source and translated sentences");
     Response response;
 
     // Move source_ into response.
     response.source = std::move(source_);
 
     // Should be after source is set
-    buildTranslatedText(histories, response);
+    buildTranslatedText(translations, response);
     return response;
   }
 
+  /// Decodes the best hypothesis of history into target text and token boundaries. Called as each sentence finishes
+  /// translating; sentences served from the cache skip this.
+  /// @param history [in]
+  Ptr<const TranslatedSentence> decode(const History &history) const;
+
  private:
   /// Builds qualityScores from histories and writes to response. expects
   /// buildTranslatedText to be run before to be able to obtain target text and
@@ -59,9 +64,9 @@ class ResponseBuilder {
   void buildAlignments(Histories &histories, Response &response);
 
   /// Builds translated text and subword annotations and writes onto response.
-  /// @param histories [in]
+  /// @param translations [in]
   /// @param response [out]
-  void buildTranslatedText(Histories &histories, Response &response);
+  void buildTranslatedText(std::vector<Ptr<const TranslatedSentence>> &translations, Response &response);
 
   // Data members are context/curried args for the functor.
 
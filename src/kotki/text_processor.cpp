@@ -68,7 +68,7 @@ TextProcessor::TextProcessor(Ptr<Options> options, const Vocabs &vocabs, const A
   //
   // For now, we allow not supplying an ssplit-prefix-file.
 
-  if (memory.begin() == nullptr && memory.size()) {
+  if (memory.begin() != nullptr && memory.size() > 0) {
     ssplit_ = loadSplitter(memory);
   } else {
     ssplit_ = loadSplitter(options->get<std::string>("ssplit-prefix-file", ""));
@@ -135,6 +135,24 @@ void TextProcessor::wrap(Segment &segment, std::vector<string_view> &wordRanges,
   }
 }
 
+Segment TextProcessor::processSentence(const string_view &sentence, std::vector<string_view> &wordRanges) const {
+  Segment segment = tokenize(sentence, wordRanges);
+
+  // Manually add EoS
+  Word sourceEosId = vocabs_.sources().front()->getEosId();
+  segment.push_back(sourceEosId);
+
+  if (!wordRanges.empty()) {
+    string_view &last = wordRanges.back();  // this is a possible segfault if wordRanges is empty. So guard.
+    const char *end = last.data() + last.size();
+    wordRanges.emplace_back(end, 0);
+  } else {
+    const char *end = sentence.data() + sentence.size();
+    wordRanges.emplace_back(end, 0);
+  }
+  return segment;
+}
+
 void TextProcessor::processFromAnnotation(AnnotatedText &source, Segments &segments) const {
   std::string copySource = source.text;
   AnnotatedText replacement(std::move(copySource));
@@ -147,22 +165,7 @@ void TextProcessor::processFromAnnotation(AnnotatedText &source, Segments &segme
     marian::string_view sentence{&replacement.text[sentenceByteRange.begin], sentenceByteRange.size()};
 
     std::vector<string_view> wordRanges;
-    Segment segment = tokenize(sentence, wordRanges);
-
-    // Manually add EoS
-    Word sourceEosId = vocabs_.sources().front()->getEosId();
-    segment.push_back(sourceEosId);
-
-    if (!wordRanges.empty()) {
-      string_view &last = wordRanges.back();  // this is a possible segfault if wordRanges is empty. So guard.
-      const char *end = last.data() + last.size();
-      wordRanges.emplace_back(end, 0);
-    } else {
-      const char *end = sentence.data() + sentence.size();
-      wordRanges.emplace_back(end, 0);
-    }
-
-    segments.push_back(std::move(segment));
+    segments.push_back(processSentence(sentence, wordRanges));
     replacement.recordExistingSentence(wordRanges.begin(), wordRanges.end(), wordRanges.begin()->data());
   }
 
@@ -52,6 +52,12 @@ class TextProcessor {
 
   void processFromAnnotation(AnnotatedText &source, Segments &segments) const;
 
+  /// Tokenizes a single sentence which needs no further splitting or wrapping, such as a sentence translated by
+  /// another model, and terminates it with EOS.
+  /// @param [in] sentence: text of the sentence.
+  /// @param [out] wordRanges: ByteRanges of the tokens in sentence, followed by an empty one for EOS.
+  Segment processSentence(const string_view &sentence, std::vector<string_view> &wordRanges) const;
+
  private:
   void parseCommonOptions(Ptr<Options> options);
 
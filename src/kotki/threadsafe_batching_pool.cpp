@@ -0,0 +1,218 @@
+#include "kotki/threadsafe_batching_pool.h"
+
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+namespace marian {
+namespace bergamot {
+
+ThreadsafeBatchingPool::ThreadsafeBatchingPool(Ptr<Options> options)
+    : backend_(options),
+      maxWait_(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double, std::milli>(options->get<double>("mini-batch-wait", 0.0)))),
+      fillTokens_(options->get<double>("mini-batch-fill", 1.0) * backend_.miniBatchWords()) {}
+
+size_t ThreadsafeBatchingPool::enqueueRequest(Ptr<Request> request) {
+  std::vector<RequestSentence> sentences;
+  size_t tokens = 0;
+  for (size_t i = 0; i < request->numSegments(); i++) {
+    if (!request->cacheHitPrefilled(i) && !request->isDuplicate(i)) {
+      RequestSentence sentence(i, request);
+      // An identical sentence may already be queued or being translated, this one then completes along with it.
+      if (sentence.acquire()) {
+        tokens += sentence.numTokens();
+        sentences.push_back(std::move(sentence));
+      }
+    }
+  }
+
+  size_t count = sentences.size();
+  if (count > 0) {
+    push(sentences, tokens, /*wakeAll=*/true);
+  }
+  return count;
+}
+
+size_t ThreadsafeBatchingPool::enqueueSentence(const RequestSentence &sentence) {
+  if (!sentence.acquire()) {
+    return 0;
+  }
+  std::vector<RequestSentence> sentences = {sentence};
+  push(sentences, sentence.numTokens(), /*wakeAll=*/false);
+  return 1;
+}
+
+void ThreadsafeBatchingPool::push(std::vector<RequestSentence> &sentences, size_t tokens, bool wakeAll) {
+  Intake &intake = intakes_[std::hash<std::thread::id>()(std::this_thread::get_id()) % numIntakes];
+  {
+    std::lock_guard<std::mutex> lock(intake.mutex);
+    size_t count = sentences.size();
+    if (intake.sentences.empty()) {
+      intake.sentences.swap(sentences);
+    } else {
+      intake.sentences.insert(intake.sentences.end(), std::make_move_iterator(sentences.begin()),
+                              std::make_move_iterator(sentences.end()));
+    }
+    pendingTokens_ += tokens;
+    if (enqueued_.fetch_add(count) == 0) {
+      pendingSince_ = std::chrono::steady_clock::now().time_since_epoch().count();
+    }
+  }
+
+  // A worker counts itself in sleeping_ before checking enqueued_ the last time, so either it sees these sentences or
+  // it is seen here. Taking sleepMutex_ then makes sure it is waiting on work_ before being notified.
+  if (sleeping_ > 0) {
+    { std::lock_guard<std::mutex> lock(sleepMutex_); }
+    if (wakeAll) {
+      work_.notify_all();
+    } else {
+      work_.notify_one();
+    }
+  }
+}
+
+void ThreadsafeBatchingPool::waitForWork() {
+  // While another thread plans, there is nothing to do but wait for it to hand out batches or give up the role.
+  auto pending = [this]() { return readyBatches_ > 0 || (!planning_ && (enqueued_ > 0 || shutdown_)); };
+  if (!pending()) {
+    std::unique_lock<std::mutex> lock(sleepMutex_);
+    sleeping_++;
+    work_.wait(lock, pending);
+    sleeping_--;
+  }
+
+  auto full = [this]() {
+    return shutdown_ || readyBatches_ > 0 || enqueued_ == 0 || pendingTokens_ >= fillTokens_;
+  };
+  if (maxWait_.count() > 0 && !full()) {
+    auto since = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(pendingSince_.load()));
+    std::unique_lock<std::mutex> lock(sleepMutex_);
+    sleeping_++;
+    work_.wait_until(lock, since + maxWait_, full);
+    sleeping_--;
+  }
+}
+
+void ThreadsafeBatchingPool::notifySleeping() {
+  // Same handshake as in push(), a worker counts itself in sleeping_ before checking planning_ the last time.
+  if (sleeping_ > 0 && (readyBatches_ > 0 || enqueued_ > 0 || shutdown_)) {
+    { std::lock_guard<std::mutex> lock(sleepMutex_); }
+    work_.notify_all();
+  }
+}
+
+size_t ThreadsafeBatchingPool::plan(Batch &batch) {
+  batch.clear();
+  if (planning_.exchange(true)) {
+    return 0;
+  }
+
+  for (Intake &intake : intakes_) {
+    {
+      std::lock_guard<std::mutex> intakeLock(intake.mutex);
+      intake.sentences.swap(drained_);
+    }
+    for (const RequestSentence &sentence : drained_) {
+      backend_.insertSentence(sentence);
+    }
+    drained_.clear();
+  }
+
+  size_t tokensBefore = backend_.pendingTokens();
+  size_t planned = backend_.generateBatch(batch);
+  // Sleeping workers would otherwise wake up only to queue for the planner role one after the other.
+  for (size_t waiting = planned > 0 ? sleeping_.load() : 0; waiting > 0; waiting--) {
+    Batch *next = ready_.reserve();
+    if (next == nullptr) {
+      break;
+    }
+    size_t sentences = backend_.generateBatch(*next);
+    if (sentences == 0) {
+      break;
+    }
+    ready_.commit();
+    readyBatches_++;
+    planned += sentences;
+  }
+  // Ready batches are counted before their sentences are uncounted, see the shutdown check in generateBatch(...).
+  pendingTokens_ -= tokensBefore - backend_.pendingTokens();
+  enqueued_ -= planned;
+
+  planning_ = false;
+  notifySleeping();
+  return batch.size();
+}
+
+size_t ThreadsafeBatchingPool::tryGenerateBatch(Batch &batch) {
+  if (ready_.pop(batch)) {
+    readyBatches_--;
+    return batch.size();
+  }
+  if (enqueued_ == 0) {
+    batch.clear();
+    return 0;
+  }
+  return plan(batch);
+}
+
+size_t ThreadsafeBatchingPool::generateBatch(Batch &batch) {
+  while (true) {
+    waitForWork();
+    size_t sentencesInBatch = tryGenerateBatch(batch);
+    if (sentencesInBatch > 0) {
+      return sentencesInBatch;
+    }
+
+    // Read in this order, a sentence moving from enqueued_ into a ready batch is seen in at least one of them.
+    if (shutdown_ && enqueued_ == 0 && readyBatches_ == 0) {
+      return 0;
+    }
+    // Otherwise another thread took the planner role first, waitForWork() sleeps until it is done.
+  }
+}
+
+ThreadsafeBatchingPool::ReadyQueue::ReadyQueue() {
+  for (size_t i = 0; i < capacity; i++) {
+    cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+Batch *ThreadsafeBatchingPool::ReadyQueue::reserve() {
+  Cell &cell = cells_[enqueuePos_ & (capacity - 1)];
+  return cell.sequence.load(std::memory_order_acquire) == enqueuePos_ ? &cell.batch : nullptr;
+}
+
+void ThreadsafeBatchingPool::ReadyQueue::commit() {
+  cells_[enqueuePos_ & (capacity - 1)].sequence.store(enqueuePos_ + 1, std::memory_order_release);
+  enqueuePos_++;
+}
+
+bool ThreadsafeBatchingPool::ReadyQueue::pop(Batch &batch) {
+  size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+  while (true) {
+    Cell &cell = cells_[pos & (capacity - 1)];
+    auto diff = static_cast<std::intptr_t>(cell.sequence.load(std::memory_order_acquire)) -
+                static_cast<std::intptr_t>(pos + 1);
+    if (diff < 0) {
+      return false;
+    }
+    if (diff > 0) {
+      pos = dequeuePos_.load(std::memory_order_relaxed);
+    } else if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+      batch = std::move(cell.batch);
+      // Free for the planner a lap later.
+      cell.sequence.store(pos + capacity, std::memory_order_release);
+      return true;
+    }
+  }
+}
+
+void ThreadsafeBatchingPool::shutdown() {
+  shutdown_ = true;
+  { std::lock_guard<std::mutex> lock(sleepMutex_); }
+  work_.notify_all();
+}
+
+}  // namespace bergamot
+}  // namespace marian
@@ -0,0 +1,139 @@
+#ifndef SRC_BERGAMOT_THREADSAFE_BATCHING_POOL_H_
+#define SRC_BERGAMOT_THREADSAFE_BATCHING_POOL_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "kotki/batch.h"
+#include "kotki/batching_pool.h"
+#include "kotki/definitions.h"
+#include "kotki/request.h"
+
+namespace marian {
+namespace bergamot {
+
+/// Thread-safe wrapper around BatchingPool, for use when several worker threads (each holding a backend replica of the
+/// same TranslationModel) draw batches from one pool while client threads keep adding requests.
+///
+/// Client threads hand sentences to one of several intakes, picked by thread, and lock only that one. One worker at a
+/// time takes the planner role (an atomic flag, nobody blocks on it), moves the intakes into the BatchingPool and plans
+/// a batch for itself plus one for each sleeping worker. Those go into a lock-free ready queue the other workers pop
+/// from. Client threads thus contend neither with each other nor with the planning, and the counters waits depend on
+/// are atomic.
+///
+/// generateBatch(...) blocks until there is work or shutdown() is called, so workers can simply loop on it.
+///
+/// With mini-batch-wait (milliseconds) set, a worker finding less than mini-batch-fill (a fraction of
+/// mini-batch-words) pending holds off until that much arrives, or until the oldest pending sentence waited
+/// mini-batch-wait. Sentences of concurrent small requests then share a forward pass instead of each taking one.
+class ThreadsafeBatchingPool {
+ public:
+  explicit ThreadsafeBatchingPool(Ptr<Options> options);
+
+  /// Adds the sentences of request to the pool and wakes up waiting workers.
+  /// @returns number of sentences which need a fresh translation.
+  size_t enqueueRequest(Ptr<Request> request);
+
+  /// Adds a single sentence to the pool and wakes up waiting workers.
+  /// @returns 1 if the sentence needs a fresh translation, 0 otherwise.
+  size_t enqueueSentence(const RequestSentence &sentence);
+
+  /// Blocks until sentences are available (and, see mini-batch-wait, enough of them or for long enough) and fills batch
+  /// with them.
+  /// @returns number of sentences in batch; 0 only after shutdown() with nothing left to translate.
+  size_t generateBatch(Batch &batch);
+
+  /// Fills batch with pending sentences, if there are any, without waiting.
+  /// @returns number of sentences in batch.
+  size_t tryGenerateBatch(Batch &batch);
+
+  /// Wakes up all waiting workers. Pending sentences are still handed out, after which generateBatch returns 0.
+  void shutdown();
+
+ private:
+  /// Sentences handed in by client threads and not yet moved into backend_.
+  struct alignas(64) Intake {
+    std::mutex mutex;
+    std::vector<RequestSentence> sentences;
+  };
+  static constexpr size_t numIntakes = 16;
+
+  /// Bounded queue of planned batches, filled by the planner only and popped by any worker (a single-producer variant
+  /// of Vyukov's MPMC queue). A cell is free for the producer once its sequence equals the enqueue position, and holds
+  /// a batch for consumers once it is one past the dequeue position.
+  class ReadyQueue {
+   public:
+    ReadyQueue();
+
+    /// Cell to plan the next batch into, nullptr while the queue is full. Planner only.
+    Batch *reserve();
+    /// Hands the batch planned into the reserved cell to consumers. Planner only.
+    void commit();
+    /// Moves the oldest planned batch into batch.
+    /// @returns false if there was none.
+    bool pop(Batch &batch);
+
+   private:
+    static constexpr size_t capacity = 64;  // power of 2
+    struct alignas(64) Cell {
+      std::atomic<size_t> sequence;
+      Batch batch;
+    };
+    std::array<Cell, capacity> cells_;
+    size_t enqueuePos_{0};
+    alignas(64) std::atomic<size_t> dequeuePos_{0};
+  };
+
+  /// Moves sentences (of tokens in total) into the intake of the calling thread, counts them as pending and wakes up
+  /// one or all waiting workers.
+  void push(std::vector<RequestSentence> &sentences, size_t tokens, bool wakeAll);
+
+  /// Blocks until a batch is ready, or sentences are pending and nobody is planning, or shutdown() was called. Then,
+  /// see mini-batch-wait, until enough sentences are pending.
+  void waitForWork();
+
+  /// Takes the planner role if nobody holds it, moves the intakes into backend_ and generates batch from it, plus
+  /// batches for sleeping workers into ready_.
+  /// @returns number of sentences in batch, 0 also if another thread is planning.
+  size_t plan(Batch &batch);
+
+  /// Wakes up waiting workers if they have anything to wake up for.
+  void notifySleeping();
+
+  /// Set while a thread plans. Only the thread which set it touches backend_ and drained_.
+  std::atomic<bool> planning_{false};
+  BatchingPool backend_;
+  /// Intake swapped out for moving its sentences into backend_, reused so that neither side allocates.
+  std::vector<RequestSentence> drained_;
+
+  std::array<Intake, numIntakes> intakes_;
+
+  ReadyQueue ready_;
+  /// Number of batches in ready_.
+  std::atomic<size_t> readyBatches_{0};
+
+  /// Number of sentences enqueued and not yet planned into a batch, and their tokens. Counted while their intake is
+  /// locked, so every sentence the planner drains is counted.
+  std::atomic<size_t> enqueued_{0};
+  std::atomic<size_t> pendingTokens_{0};
+  std::atomic<bool> shutdown_{false};
+
+  std::chrono::steady_clock::duration maxWait_;
+  size_t fillTokens_;
+  /// Since when sentences are pending without interruption, the wait for a fuller batch ends maxWait_ after.
+  std::atomic<std::chrono::steady_clock::rep> pendingSince_{0};
+
+  /// Workers block on work_. Client threads only take sleepMutex_ to wake them, and only when sleeping_ says any wait.
+  std::mutex sleepMutex_;
+  std::condition_variable work_;
+  std::atomic<size_t> sleeping_{0};
+};
+
+}  // namespace bergamot
+}  // namespace marian
+
+#endif  // SRC_BERGAMOT_THREADSAFE_BATCHING_POOL_H_
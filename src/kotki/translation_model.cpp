@@ -17,12 +17,13 @@ std::atomic<size_t> TranslationModel::modelCounter_ = 0;
 TranslationModel::TranslationModel(const Config &options, MemoryBundle &&memory /*=MemoryBundle{}*/,
                                    size_t replicas /*=1*/)
     : modelId_(modelCounter_++),
+      cacheNamespace_(modelId_),
       options_(options),
       memory_(std::move(memory)),
       vocabs_(options, std::move(memory_.vocabs)),
       textProcessor_(options, vocabs_, std::move(memory_.ssplitPrefixFile)),
       batchingPool_(options),
-      qualityEstimator_(createQualityEstimator(getQualityEstimatorModel(memory, options))) {
+      qualityEstimator_(createQualityEstimator(getQualityEstimatorModel(memory_, options))) {
   ABORT_IF(replicas == 0, "At least one replica needs to be created.");
   backend_.resize(replicas);
 
@@ -59,13 +60,7 @@ void TranslationModel::loadBackend(size_t idx) {
   graph->setDevice(device_);
   graph->getBackend()->configureDevice(options_);
 
-#ifdef __arm__
-  graph->reserveWorkspaceMB(128);
-#elif __x86_64__
-  graph->reserveWorkspaceMB(512);
-#else
-  throw std::runtime_error("unknown arch");
-#endif
+  graph->reserveWorkspaceMB(workspaceBytes() >> 20);
 
   // Marian Model: Load from memoryBundle or shortList
   if (memory_.model.size() > 0 &&
@@ -94,8 +89,32 @@ void TranslationModel::loadBackend(size_t idx) {
   graph->forward();
 }
 
+size_t TranslationModel::workspaceBytes() {
+#ifdef __arm__
+  return size_t(128) << 20;
+#elif __x86_64__
+  return size_t(512) << 20;
+#else
+  throw std::runtime_error("unknown arch");
+#endif
+}
+
+uint64_t TranslationModel::checksum() const {
+  if (memory_.model.size() > 0) {
+    return hashBytes(memory_.model.begin(), memory_.model.size(), /*seed=*/0);
+  }
+  // Parameters are read from an .npz by marian itself, identify it by path instead.
+  auto models = options_->get<std::vector<std::string>>("models");
+  std::string paths;
+  for (auto &path : models) {
+    paths += path;
+  }
+  return hashBytes(paths.data(), paths.size(), /*seed=*/0);
+}
+
 // Make request process is shared between Async and Blocking workflow of translating.
-Ptr<Request> TranslationModel::makeRequest(std::string &&source, std::optional<TranslationCache> &cache) {
+Ptr<Request> TranslationModel::makeRequest(std::string &&source, std::optional<TranslationCache> &cache,
+                                           CallbackType callback, Schedule schedule) {
   Segments segments;
   AnnotatedText annotatedSource;
 
@@ -103,7 +122,46 @@ Ptr<Request> TranslationModel::makeRequest(std::string &&source, std::optional<T
   ResponseBuilder responseBuilder(std::move(annotatedSource), vocabs_, *qualityEstimator_);
 
   Ptr<Request> request =
-      New<Request>(/*model=*/*this, std::move(segments), std::move(responseBuilder), cache);
+      New<Request>(/*model=*/*this, std::move(segments), std::move(responseBuilder), cache, inFlight_,
+                   std::move(callback), /*onSentence=*/nullptr, schedule);
+  duplicateSentences_ += request->duplicateSentences();
+  return request;
+}
+
+Ptr<Request> TranslationModel::makePivotRequest(std::string &&source, std::optional<TranslationCache> &cache,
+                                               std::vector<PivotTarget> targets, CallbackType callback,
+                                               Schedule schedule) {
+  Segments segments;
+  AnnotatedText annotatedSource;
+  textProcessor_.process(std::move(source), annotatedSource, segments);
+
+  // Each segment of the first hop becomes exactly one segment of the second, and the gaps between sentences carry over
+  // unchanged through both translations. The second hops can thus build their Response on the original source.
+  std::vector<Ptr<Request>> targetRequests;
+  for (auto &target : targets) {
+    ResponseBuilder targetResponseBuilder(AnnotatedText(annotatedSource), target.model->vocabs_,
+                                          *target.model->qualityEstimator_);
+    targetRequests.push_back(New<Request>(/*model=*/*target.model, segments.size(), std::move(targetResponseBuilder),
+                                          target.cache, target.model->inFlight_, std::move(target.callback),
+                                          schedule));
+  }
+
+  auto onSentence = [targets, targetRequests](size_t index, const TranslatedSentence &translation) {
+    string_view sentence(translation.text.data(), translation.text.size());
+    for (size_t t = 0; t < targets.size(); t++) {
+      auto &target = *targets[t].model;
+      std::vector<string_view> wordRanges;
+      Segment segment = target.textProcessor_.processSentence(sentence, wordRanges);
+      if (targetRequests[t]->provideSegment(index, std::move(segment))) {
+        target.batchingPool_.enqueueSentence(RequestSentence(index, targetRequests[t]));
+      }
+    }
+  };
+
+  ResponseBuilder responseBuilder(std::move(annotatedSource), vocabs_, *qualityEstimator_);
+  Ptr<Request> request = New<Request>(/*model=*/*this, std::move(segments), std::move(responseBuilder), cache,
+                                      inFlight_, std::move(callback), std::move(onSentence), schedule);
+  duplicateSentences_ += request->duplicateSentences();
   return request;
 }
 
@@ -173,6 +231,18 @@ Ptr<marian::data::CorpusBatch> TranslationModel::convertToMarianBatch(Batch &bat
 }
 
 void TranslationModel::translateBatch(size_t deviceId, Batch &batch) {
+  Batch::Stats stats = batch.stats();
+  Batch::log(stats);
+  batches_++;
+  batchSentences_ += stats.sentences;
+  batchTokens_ += stats.tokens;
+  batchPaddedTokens_ += stats.paddedTokens;
+
+  runBatch(deviceId, batch);
+}
+
+void TranslationModel::runBatch(size_t deviceId, Batch &batch) {
+  ABORT_IF(deviceId >= backend_.size(), "deviceId {} exceeds the {} available replicas", deviceId, backend_.size());
   auto &backend = backend_[deviceId];
 
   if (!backend.initialized) {
@@ -185,5 +255,17 @@ void TranslationModel::translateBatch(size_t deviceId, Batch &batch) {
   batch.completeBatch(histories);
 }
 
+void TranslationModel::warmup(size_t deviceId) {
+  std::optional<TranslationCache> noCache;
+  Ptr<Request> request = makeRequest("This sentence warms up the model.", noCache);
+
+  Batch batch;
+  for (size_t index = 0; index < request->numSegments(); index++) {
+    batch.add(RequestSentence(index, request));
+  }
+  // not a batch of any client, kept out of batchTotals()
+  runBatch(deviceId, batch);
+}
+
 }  // namespace bergamot
 }  // namespace marian
@@ -14,6 +14,7 @@
 #include "kotki/parser.h"
 #include "kotki/request.h"
 #include "kotki/text_processor.h"
+#include "kotki/threadsafe_batching_pool.h"
 #include "marian-lite/translator/history.h"
 #include "marian-lite/translator/scorers.h"
 #include "kotki/vocabs.h"
@@ -21,12 +22,25 @@
 namespace marian {
 namespace bergamot {
 
+class TranslationModel;
+
+/// Second hop of a pivot translation, see TranslationModel::makePivotRequest.
+struct PivotTarget {
+  Ptr<TranslationModel> model;
+
+  /// Cache of model, nullopt to disable.
+  std::optional<TranslationCache>& cache;
+
+  /// Issued with the Response of this hop. Its source is the original source text, its target the final translation.
+  CallbackType callback;
+};
+
 /// A TranslationModel is associated with the translation of a single language direction. Holds the graph and other
 /// structures required to run the forward pass of the neural network, along with preprocessing logic (TextProcessor)
 /// and a BatchingPool to create batches that are to be used in conjuction with an instance.
 ///
-/// Thread-safety is not handled here, but the methods are available at granularity enough to be used in threaded async
-/// workflow for translation.
+/// Requests can be enqueued and batches generated concurrently from several threads. translateBatch is safe to call
+/// concurrently as long as each thread uses its own deviceId (backend replica).
 
 class TranslationModel {
  public:
@@ -67,21 +81,48 @@ class TranslationModel {
   /// Response corresponding to the Request created here.
   /// @param [in] callback: Callback (from client) to be issued upon completion of translation of all sentences in the
   /// created Request.
-  /// @param [in] responseOptions: Configuration used to prepare the Response corresponding to the created request.
+  /// @param [in] cache: Cache used to prefill and store translations of sentences, nullopt to disable.
+  /// @param [in] schedule: Priority and deadline to batch the sentences of the Request with.
   //  @returns Request created from the query parameters wrapped within a shared-pointer.
-  Ptr<Request> makeRequest(std::string&& source, std::optional<TranslationCache>& cache);
+  Ptr<Request> makeRequest(std::string&& source, std::optional<TranslationCache>& cache,
+                           CallbackType callback = nullptr, Schedule schedule = {});
+
+  /// Make a Request translating source with this model into the pivot language, and from there on with each of
+  /// targets. Each sentence this model finishes is tokenized for the targets and enqueued with them right away, reusing
+  /// the sentence boundaries of the first hop instead of splitting the intermediate text again. The hops overlap, a
+  /// document is done shortly after its last sentence passes both models rather than after two full passes. The first
+  /// hop is translated once however many targets there are.
+  ///
+  /// @param [in] source: Source text to be translated.
+  /// @param [in] cache: Cache of this model, nullopt to disable.
+  /// @param [in] targets: Second hops, each translating from the target language of this model.
+  /// @param [in] callback: Optional callback issued with the Response of the first hop.
+  /// @param [in] schedule: Priority and deadline of the first hop, the second hops inherit them.
+  /// @returns Request of the first hop, to be enqueued with this model.
+  Ptr<Request> makePivotRequest(std::string&& source, std::optional<TranslationCache>& cache,
+                                std::vector<PivotTarget> targets, CallbackType callback = nullptr,
+                                Schedule schedule = {});
 
   /// Relays a request to the batching-pool specific to this translation model.
   /// @param [in] request: Request constructed through makeRequest
   size_t enqueueRequest(Ptr<Request> request) { return batchingPool_.enqueueRequest(request); };
 
-  /// Generates a batch from the batching-pool for this translation model, compiling from several active requests. Note
-  /// that it is possible that calls to this method can give empty-batches.
+  /// Generates a batch from the batching-pool for this translation model, compiling from several active requests. Blocks
+  /// until sentences are available, hence only call this after enqueueRequest reported sentences to translate or from
+  /// a worker thread.
   ///
   /// @param [out] batch: Batch to write a generated batch on to.
-  /// @returns number of sentences that constitute the Batch.
+  /// @returns number of sentences that constitute the Batch, 0 once shutdown() was called and the pool is drained.
   size_t generateBatch(Batch& batch) { return batchingPool_.generateBatch(batch); }
 
+  /// generateBatch without blocking, for callers translating on their own thread: their sentences may have been batched
+  /// by another caller already.
+  /// @returns number of sentences that constitute the Batch, 0 if there are none pending.
+  size_t tryGenerateBatch(Batch& batch) { return batchingPool_.tryGenerateBatch(batch); }
+
+  /// Releases worker threads blocked in generateBatch.
+  void shutdown() { batchingPool_.shutdown(); }
+
   /// Translate a batch generated with generateBatch
   ///
   /// @param [in] deviceId: There are replicas of backend created for use in each worker thread. deviceId indicates
@@ -89,18 +130,64 @@ class TranslationModel {
   /// @param [in] batch: A batch generated from generateBatch from the same TranslationModel instance.
   void translateBatch(size_t deviceId, Batch& batch);
 
+  /// Builds the backend replica deviceId and runs a short sentence through it, so that the first batch of a client does
+  /// not pay for allocating the graph and workspace. Bypasses the batching-pool and caches, call it before worker
+  /// threads are translating with the same replica.
+  ///
+  /// @param [in] deviceId: Replica to warm up, as in translateBatch.
+  void warmup(size_t deviceId);
+
   /// Returns a unique-identifier for the model.
   size_t modelId() const { return modelId_; }
 
+  /// Seed of the cache keys of this model (see hashForCache). Defaults to modelId(), which is only unique within the
+  /// process. Set it to checksum() before translating when cache entries should be valid across processes.
+  size_t cacheNamespace() const { return cacheNamespace_; }
+  void setCacheNamespace(size_t cacheNamespace) { cacheNamespace_ = cacheNamespace; }
+
+  /// Checksum of the model parameters, identifies the model independent of file location and process.
+  uint64_t checksum() const;
+
+  /// Bytes of workspace each backend replica reserves when it is built.
+  static size_t workspaceBytes();
+
+  /// Number of sentences so far which repeated an earlier sentence of the same request, and were not translated again.
+  size_t duplicateSentences() const { return duplicateSentences_; }
+
+  /// Batch::stats() summed over all batches translated so far.
+  struct BatchTotals {
+    size_t batches{0};
+    size_t sentences{0};
+    size_t tokens{0};
+    size_t paddedTokens{0};
+  };
+  BatchTotals batchTotals() const {
+    return BatchTotals{batches_, batchSentences_, batchTokens_, batchPaddedTokens_};
+  }
+
+  /// Number of backend replicas, valid deviceIds for translateBatch are [0, replicas()).
+  size_t replicas() const { return backend_.size(); }
+
  private:
   size_t modelId_;
+  size_t cacheNamespace_;
   Config options_;
   MemoryBundle memory_;
   Vocabs vocabs_;
   TextProcessor textProcessor_;
 
   /// Maintains sentences from multiple requests bucketed by length and sorted by priority in each bucket.
-  BatchingPool batchingPool_;
+  ThreadsafeBatchingPool batchingPool_;
+
+  /// Sentences in batchingPool_ or being translated, identical ones arriving meanwhile are not batched again.
+  InFlightSentences inFlight_;
+
+  std::atomic<size_t> duplicateSentences_{0};
+
+  std::atomic<size_t> batches_{0};
+  std::atomic<size_t> batchSentences_{0};
+  std::atomic<size_t> batchTokens_{0};
+  std::atomic<size_t> batchPaddedTokens_{0};
 
   /// A package of marian-entities which form a backend to translate.
   struct MarianBackend {
@@ -122,6 +209,8 @@ class TranslationModel {
 
   void loadBackend(size_t idx);
   Ptr<marian::data::CorpusBatch> convertToMarianBatch(Batch& batch);
+  /// Translates batch on replica deviceId, building it first if needed. translateBatch without the accounting.
+  void runBatch(size_t deviceId, Batch& batch);
 
   static std::atomic<size_t> modelCounter_;
 };